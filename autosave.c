@@ -0,0 +1,195 @@
+/* autosave - the ECS database is serialized (a memory copy, cheap next
+ * to the disk) between turns and written out by a background thread,
+ * first to file.tmp and then renamed over the file, so input is never
+ * held up by the disk and a crash mid-save leaves the old save intact.
+ * only the game on the screen saves */
+
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "prentice.h"
+
+#define SAVE_CHUNK 65536
+
+enum { SAVE_IDLE, SAVE_WRITING, SAVE_DONE, SAVE_FAILED };
+static const char *State_Names[] = {"idle", "writing", "done", "failed"};
+
+// set up by the game thread while no writer is running, then only read
+// by the writer until it sets the state to done or failed
+static struct {
+    pthread_t thread;
+    Tcl_Obj *image; // the serialized database, held until joined
+    const unsigned char *bytes;
+    char *file;
+    size_t total;
+    size_t written; // progress of the writer
+    int state;
+    int saves;
+    double secs; // how long the last save took
+} Save;
+
+static void autosave_finish(void);
+static void autosave_join(void);
+static void *autosave_write(void *unused);
+static int pr_autosave(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_autosave_status(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]);
+static int sync_parent(const char *file);
+static int write_all(int fd, const unsigned char *buf, size_t len);
+
+void autosave_commands(struct game *game) {
+    if (game->hosted) return;
+    LINK_COMMAND(game, "autosave", pr_autosave);
+    LINK_COMMAND(game, "autosave_status", pr_autosave_status);
+    atexit(autosave_finish);
+}
+
+// on the way out, waits for any save in progress (TCL may already be
+// finalized, so the image is left alone)
+static void autosave_finish(void) {
+    if (Save.image == NULL) return;
+    if (__atomic_load_n(&Save.state, __ATOMIC_ACQUIRE) == SAVE_WRITING)
+        log_msg(LOG_INFO, "waiting on autosave to %s", Save.file);
+    pthread_join(Save.thread, NULL);
+    Save.image = NULL;
+}
+
+// releases what the last writer was given, once it is done
+static void autosave_join(void) {
+    if (Save.image == NULL) return;
+    pthread_join(Save.thread, NULL);
+    Tcl_DecrRefCount(Save.image);
+    Save.image = NULL;
+    free(Save.file);
+    Save.file = NULL;
+}
+
+static void *autosave_write(void *unused) {
+    int fd;
+    uint64_t start = timing_now();
+    char tmp[PATH_MAX];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", Save.file);
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+        log_msg(LOG_WARN, "autosave could not write %s: %s", tmp,
+                strerror(errno));
+        __atomic_store_n(&Save.state, SAVE_FAILED, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    int bad = write_all(fd, Save.bytes, Save.total) == -1 || fsync(fd) == -1;
+    if (close(fd) == -1) bad = 1;
+    if (bad || rename(tmp, Save.file) == -1) {
+        log_msg(LOG_WARN, "autosave to %s failed: %s", Save.file,
+                strerror(errno));
+        unlink(tmp);
+        __atomic_store_n(&Save.state, SAVE_FAILED, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    // the rename is only durable once the directory is
+    if (sync_parent(Save.file) == -1) {
+        log_msg(LOG_WARN, "autosave could not sync the directory of %s: %s",
+                Save.file, strerror(errno));
+        __atomic_store_n(&Save.state, SAVE_FAILED, __ATOMIC_RELEASE);
+        return NULL;
+    }
+    Save.secs = (timing_now() - start) / 1e9;
+    log_msg(LOG_INFO, "autosave %zu bytes to %s in %.6f s", Save.total,
+            Save.file, Save.secs);
+    __atomic_store_n(&Save.state, SAVE_DONE, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// file - starts writing the database out unless a save is already
+// under way; returns whether it did
+static int pr_autosave(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    assert(objc == 2);
+    if (__atomic_load_n(&Save.state, __ATOMIC_ACQUIRE) == SAVE_WRITING) {
+        log_msg(LOG_DEBUG, "autosave skipped, still writing");
+        Tcl_SetObjResult(interp, Tcl_NewBooleanObj(0));
+        return TCL_OK;
+    }
+    autosave_join();
+    int ret = Tcl_EvalEx(interp, "ecs serialize", -1, TCL_EVAL_GLOBAL);
+    if (ret != TCL_OK) return ret;
+    Save.image = Tcl_GetObjResult(interp);
+    Tcl_IncrRefCount(Save.image);
+    Tcl_ResetResult(interp);
+    int len;
+    Save.bytes = Tcl_GetByteArrayFromObj(Save.image, &len);
+    if ((Save.file = strdup(Tcl_GetString(objv[1]))) == NULL) oom();
+    Save.total   = (size_t) len;
+    Save.written = 0;
+    Save.state   = SAVE_WRITING;
+    Save.saves++;
+    if ((errno = pthread_create(&Save.thread, NULL, autosave_write, NULL))) {
+        log_msg(LOG_WARN, "autosave thread failed: %s", strerror(errno));
+        Save.state = SAVE_FAILED;
+        Tcl_DecrRefCount(Save.image);
+        Save.image = NULL;
+        free(Save.file);
+        Save.file = NULL;
+        Tcl_SetObjResult(interp, Tcl_NewBooleanObj(0));
+        return TCL_OK;
+    }
+    log_msg(LOG_DEBUG, "autosave of turn %lld started",
+            (long long) game->turn);
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(1));
+    return TCL_OK;
+}
+
+// state, bytes written and total of the current or last save, how long
+// the last finished save took, and how many saves were started
+static int pr_autosave_status(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    int state     = __atomic_load_n(&Save.state, __ATOMIC_ACQUIRE);
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("state", -1),
+                   Tcl_NewStringObj(State_Names[state], -1));
+    Tcl_DictObjPut(
+        NULL, dict, Tcl_NewStringObj("written", -1),
+        Tcl_NewWideIntObj((Tcl_WideInt) __atomic_load_n(&Save.written,
+                                                        __ATOMIC_RELAXED)));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("total", -1),
+                   Tcl_NewWideIntObj((Tcl_WideInt) Save.total));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("secs", -1),
+                   Tcl_NewDoubleObj(state == SAVE_DONE ? Save.secs : 0.0));
+    Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj("saves", -1),
+                   Tcl_NewIntObj(Save.saves));
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+// fsyncs the directory the file is in
+static int sync_parent(const char *file) {
+    char dir[PATH_MAX];
+    const char *slash = strrchr(file, '/');
+    if (slash == NULL)
+        strcpy(dir, ".");
+    else if (slash == file)
+        strcpy(dir, "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int) (slash - file), file);
+    int fd = open(dir, O_RDONLY | O_DIRECTORY);
+    if (fd == -1) return -1;
+    int ret = fsync(fd);
+    if (close(fd) == -1) ret = -1;
+    return ret;
+}
+
+static int write_all(int fd, const unsigned char *buf, size_t len) {
+    while (len) {
+        size_t want = len < SAVE_CHUNK ? len : SAVE_CHUNK;
+        ssize_t ret = write(fd, buf, want);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += ret;
+        len -= ret;
+        __atomic_add_fetch(&Save.written, (size_t) ret, __ATOMIC_RELAXED);
+    }
+    return 0;
+}
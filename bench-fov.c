@@ -0,0 +1,132 @@
+/* bench-fov - digital_fov and digital_los throughput over synthetic
+ * maps at each radius up to MAX_FOV_RADIUS, one JSON object per line
+ * (times in nanoseconds) */
+
+#include "digital-fov.h"
+#include "prentice.h"
+
+#define MAP_SIZE 64
+#define SAMPLES 4096
+
+static int center(void);
+static int **make_map(const char *type);
+static uint64_t now(void);
+static int cmp_u64(const void *a, const void *b);
+static void report(const char *bench, const char *type, int radius,
+                   uint64_t *times, int count);
+
+// random coordinate at least the max radius away from the map edges
+inline static int center(void) {
+    return MAX_FOV_RADIUS + ranval() % (MAP_SIZE - 2 * MAX_FOV_RADIUS);
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return x < y ? -1 : x > y;
+}
+
+// the digital FOV code calls oom() on malloc failure
+void fatal(const char *const fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+// open - no walls, pillars - a wall every third cell, maze - random
+// walls at about 30%
+static int **make_map(const char *type) {
+    int **map;
+    if ((map = malloc(sizeof(int *) * MAP_SIZE)) == NULL) oom();
+    if ((map[0] = calloc(MAP_SIZE * MAP_SIZE, sizeof(int))) == NULL) oom();
+    for (int x = 1; x < MAP_SIZE; x++)
+        map[x] = map[0] + x * MAP_SIZE;
+    for (int x = 0; x < MAP_SIZE; x++) {
+        for (int y = 0; y < MAP_SIZE; y++) {
+            if (strcmp(type, "pillars") == 0)
+                map[x][y] = x % 3 == 1 && y % 3 == 1;
+            else if (strcmp(type, "maze") == 0)
+                map[x][y] = ranval() % 10 < 3;
+        }
+    }
+    return map;
+}
+
+static uint64_t now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + (uint64_t) ts.tv_nsec;
+}
+
+static void report(const char *bench, const char *type, int radius,
+                   uint64_t *times, int count) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++)
+        total += times[i];
+    qsort(times, count, sizeof(uint64_t), cmp_u64);
+    printf("{\"bench\":\"%s\",\"map\":\"%s\",\"radius\":%d,\"calls\":%d,"
+           "\"per_sec\":%.1f,\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,"
+           "\"max\":%llu}\n",
+           bench, type, radius, count, count / (total / 1e9),
+           (unsigned long long) times[count / 2],
+           (unsigned long long) times[count * 9 / 10],
+           (unsigned long long) times[count * 99 / 100],
+           (unsigned long long) times[count - 1]);
+}
+
+int main(void) {
+    const char *types[] = {"open", "pillars", "maze", NULL};
+    uint64_t *times;
+    static int targets[2 * (2 * MAX_FOV_RADIUS + 1) * (2 * MAX_FOV_RADIUS + 1)],
+        seen[(2 * MAX_FOV_RADIUS + 1) * (2 * MAX_FOV_RADIUS + 1)];
+    int **fov = malloc(sizeof(int *) * (2 * MAX_FOV_RADIUS + 1));
+    if (fov == NULL) oom();
+    for (int i = 0; i < 2 * MAX_FOV_RADIUS + 1; i++)
+        if ((fov[i] = malloc(sizeof(int) * (2 * MAX_FOV_RADIUS + 1))) == NULL)
+            oom();
+    if ((times = malloc(sizeof(uint64_t) * SAMPLES)) == NULL) oom();
+    raninit(42);
+
+    for (int t = 0; types[t] != NULL; t++) {
+        int **map = make_map(types[t]);
+        for (int radius = 1; radius <= MAX_FOV_RADIUS; radius++) {
+            for (int i = 0; i < SAMPLES; i++) {
+                int x = center(), y = center();
+                uint64_t start = now();
+                digital_fov(map, MAP_SIZE, MAP_SIZE, fov, x, y, radius);
+                times[i] = now() - start;
+            }
+            report("digital_fov", types[t], radius, times, SAMPLES);
+
+            for (int i = 0; i < SAMPLES; i++) {
+                int x = center(), y = center();
+                int tx = x - radius + ranval() % (2 * radius + 1);
+                int ty = y - radius + ranval() % (2 * radius + 1);
+                uint64_t start = now();
+                digital_los(map, MAP_SIZE, MAP_SIZE, x, y, tx, ty);
+                times[i] = now() - start;
+            }
+            report("digital_los", types[t], radius, times, SAMPLES);
+
+            // every grid in the radius, where digital_los_batch does
+            // one FOV once there are enough of them
+            int side = 2 * radius + 1, count = side * side;
+            for (int i = 0; i < SAMPLES; i++) {
+                int x = center(), y = center();
+                for (int j = 0; j < count; j++) {
+                    targets[2 * j]     = x - radius + j / side;
+                    targets[2 * j + 1] = y - radius + j % side;
+                }
+                uint64_t start = now();
+                digital_los_batch(map, MAP_SIZE, MAP_SIZE, x, y, count,
+                                  targets, seen);
+                times[i] = now() - start;
+            }
+            report("digital_los_batch", types[t], radius, times, SAMPLES);
+        }
+        free(map[0]);
+        free(map);
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,190 @@
+# bench.tcl - benchmarks of the TCL and SQL side of things, run after
+# init.tcl has set up the usual game via
+#
+#   ./prentice -n -b bench.tcl
+#
+# results are one JSON object per line with times in nanoseconds
+
+# random movement keys in place of the keyboard, until there have been
+# enough of them
+proc bench_getch {} {
+    global bench_keys
+    if {[incr bench_keys -1] < 0} {error bench-done}
+    lindex {104 106 107 108 121 117 98 110} [expr {int(rand() * 8)}]
+}
+
+proc bench_report {name args} {
+    set stats [timing_stats $name]
+    set line "{\"bench\":\"$name\""
+    foreach {key value} [list {*}$args {*}$stats] {
+        append line ",\"$key\":$value"
+    }
+    if {[dict exists $stats count] && [dict get $stats mean] > 0} {
+        append line [format {,"per_sec":%.1f} \
+          [expr {1e9 / [dict get $stats mean]}]]
+    }
+    puts "$line}"
+}
+
+# timed calls of the given script, recorded under name, stopping early
+# once ten seconds have gone by
+proc bench_time {name count script} {
+    set budget [+ [timing_now] 10000000000]
+    for {set i 0} {$i < $count && [timing_now] < $budget} {incr i} {
+        set start [timing_now]
+        uplevel 1 $script
+        timing_add $name $start
+    }
+}
+
+# bulk monsters spread over the first level, every other one solid and
+# every tenth opaque
+proc bench_populate {count} {
+    global boundary ecs zlevel
+    lassign $boundary xmin ymin xmax ymax
+    set interact act_fight
+    set ch [scan M %c]
+    ecs transaction {
+        for {set i 0} {$i < $count} {incr i} {
+            set x [expr {$xmin + int(rand() * ($xmax - $xmin + 1))}]
+            set y [expr {$ymin + int(rand() * ($ymax - $ymin + 1))}]
+            ecs eval {INSERT INTO ents(name) VALUES('bench')}
+            set entid [ecs last_insert_rowid]
+            ecs eval {
+                INSERT INTO position(entid,w,x,y,interact)
+                VALUES($entid,0,$x,$y,$interact);
+                INSERT INTO display VALUES($entid,$ch,$zlevel(monst))
+            }
+            cellput 0 $x $y $entid $ch $zlevel(monst) $interact
+            if {$i % 2 == 0} {set_component $entid solid}
+            if {$i % 10 == 0} {set_component $entid opaque}
+        }
+    }
+}
+
+expr {srand(42)}
+
+# the full game loop, with keyboard input coming from bench_getch
+rename getch real_getch
+rename bench_getch getch
+set bench_keys 2000
+set start [timing_now]
+if {[catch {use_energy} err] && $err ne "bench-done"} {error $err}
+set elapsed [- [timing_now] $start]
+rename getch {}
+rename real_getch getch
+puts [format {{"bench":"turns","keys":2000,"turns":%d,"ns":%d,"per_sec":%.1f}} \
+  $turn $elapsed [expr {2000 * 1e9 / $elapsed}]]
+bench_report use_energy
+bench_report digital_fov
+bench_report drawmap
+bench_report doupdate
+
+# pathfinding between random cells of the first level, and the flow map
+# every chaser would share plus one step of it for each
+proc bench_random_cell {} {
+    global boundary
+    lassign $boundary xmin ymin xmax ymax
+    list [expr {$xmin + int(rand() * ($xmax - $xmin + 1))}] \
+      [expr {$ymin + int(rand() * ($ymax - $ymin + 1))}]
+}
+bench_time path 10000 {
+    lassign [bench_random_cell] sx sy
+    path [list 0 $sx $sy] {*}[bench_random_cell]
+}
+bench_report path
+bench_time flowmap 10000 {flowmap bench 0 [bench_random_cell]}
+bench_report flowmap
+bench_time flowstep 10000 {flowstep bench 0 {*}[bench_random_cell]}
+bench_report flowstep
+
+# these get slower with more entities; any that takes over a second at
+# one count is skipped for the larger counts
+proc bench_move_blocked {count} {
+    global boundary
+    set ent(entid) 1
+    lassign $boundary xmin ymin xmax ymax
+    bench_time "move_blocked $count" [expr {max(5, 100000 / $count)}] {
+        move_blocked ent 1 0 \
+          [expr {$xmin + int(rand() * ($xmax - $xmin + 1))}] \
+          [expr {$ymin + int(rand() * ($ymax - $ymin + 1))}]
+    }
+}
+
+# the map layers are kept current as things move, so this should not
+# depend on how many entities there are
+proc bench_update_map {count} {
+    set ent(entid) 1
+    bench_time "update_map $count" [expr {max(5, 100000 / $count)}] {
+        update_map ent 1
+    }
+}
+
+set have 0
+set slow {}
+foreach count {1000 10000 100000} {
+    bench_populate [- $count $have]
+    set have $count
+    foreach name {move_blocked update_map} {
+        if {$name in $slow} {
+            puts "{\"bench\":\"$name $count\",\"entities\":$count,\"skipped\":true}"
+            continue
+        }
+        bench_$name $count
+        bench_report "$name $count" entities $count
+        if {[dict get [timing_stats "$name $count"] mean] > 1000000000} {
+            lappend slow $name
+        }
+    }
+}
+
+# an area effect from the first entity at count of the bulk ones, all
+# in one resolve_attacks call; hp enough that none of them die of it
+set attacks {}
+ecs eval {SELECT entid FROM ents WHERE name='bench'} row {
+    statset $row(entid) 1000000000 0 0
+    lappend attacks 1 $row(entid)
+}
+foreach count {10 100 1000 10000} {
+    set some [lrange $attacks 0 [- [* 2 $count] 1]]
+    bench_time "resolve_attacks $count" 1000 {resolve_attacks $some}
+    bench_report "resolve_attacks $count" targets $count
+}
+
+# a tick event on each of count of the bulk ones, dispatched in one
+# eventrun (to effect_burning, for which none of them are burning)
+set ticks {}
+ecs eval {
+    SELECT entid,w,x,y FROM position INNER JOIN ents USING (entid)
+    WHERE name='bench'
+} row {
+    lappend ticks $row(w) $row(x) $row(y) $row(entid)
+}
+foreach count {10 100 1000} {
+    set some [lrange $ticks 0 [- [* 4 $count] 1]]
+    bench_time "eventrun $count" 100 {
+        foreach {w x y id} $some {eventpost tick $w $x $y $id}
+        eventrun
+    }
+    bench_report "eventrun $count" events $count
+}
+
+# dozens of lights each moving a cell, as carried torches would, and a
+# wall in the midst of them coming and going; only the lights changed
+# are worked out again
+set lights {}
+for {set i 0} {$i < 50} {incr i} {
+    lappend lights [+ 1000000 $i] [% $i 9] [/ $i 9]
+}
+set step 0
+bench_time "lightset 50" 1000 {
+    set step [- 1 $step]
+    foreach {id x y} $lights {lightset $id 0 [+ $x $step] $y 5}
+}
+bench_report "lightset 50" lights 50
+bench_time "mapwall 50 lights" 1000 {
+    mapwall 0 5 2 1
+    mapwall 0 5 2 0
+}
+bench_report "mapwall 50 lights" lights 50
+foreach {id x y} $lights {lightdel $id}
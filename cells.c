@@ -0,0 +1,248 @@
+/* cell stacks - what is in each cell of the map, highest zlevel first,
+ * so that what to draw and what a move into the cell interacts with
+ * are found without SQL. kept up to date by set_position and move_ent
+ * in init.tcl; the top of each stack is also copied to the map_chars
+ * layer that gets drawn */
+
+#include "prentice.h"
+
+// a displayed entity in a cell
+struct cellent {
+    Tcl_WideInt entid;
+    Tcl_Obj *interact;
+    int ch, zlevel;
+};
+
+// most cells hold a floor and maybe a thing or two on it
+#define CELL_MIN_SIZE 4
+
+struct cell {
+    struct cellent *ents; // sorted by zlevel, highest first
+    int count, size;
+};
+
+static struct cell *cell_at(struct game *game, int lvl, int x, int y);
+static void cell_del(struct cell *cell, Tcl_WideInt entid,
+                     struct cellent *removed);
+static void cell_put(struct cell *cell, struct cellent *ent);
+static void cell_top(struct game *game, int lvl, int x, int y);
+static int pr_celldel(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_cellinit(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_cellmove(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_cellput(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_celltop(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+
+inline static struct cell *cell_at(struct game *game, int lvl, int x,
+                                   int y) {
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    return &game->map_cells[lvl][x * game->map_size_y + y];
+}
+
+// takes the entity out of the cell, if it is there, handing over its
+// interact reference to removed
+static void cell_del(struct cell *cell, Tcl_WideInt entid,
+                     struct cellent *removed) {
+    for (int i = 0; i < cell->count; i++) {
+        if (cell->ents[i].entid != entid) continue;
+        *removed = cell->ents[i];
+        memmove(&cell->ents[i], &cell->ents[i + 1],
+                sizeof(struct cellent) * (cell->count - i - 1));
+        cell->count--;
+        return;
+    }
+    removed->interact = NULL;
+}
+
+// after any others of the same zlevel, so the first placed stays on top
+static void cell_put(struct cell *cell, struct cellent *ent) {
+    if (cell->count == cell->size) {
+        cell->size = cell->size ? cell->size * 2 : CELL_MIN_SIZE;
+        if ((cell->ents = realloc(cell->ents, sizeof(struct cellent) *
+                                                  cell->size)) == NULL)
+            oom();
+    }
+    int i = cell->count;
+    while (i > 0 && cell->ents[i - 1].zlevel < ent->zlevel) {
+        cell->ents[i] = cell->ents[i - 1];
+        i--;
+    }
+    cell->ents[i] = *ent;
+    cell->count++;
+}
+
+inline static void cell_top(struct game *game, int lvl, int x, int y) {
+    struct cell *cell = cell_at(game, lvl, x, y);
+    game->map_chars[lvl][x][y] = cell->count ? cell->ents[0].ch : ' ';
+}
+
+void cells_commands(struct game *game) {
+    LINK_COMMAND(game, "celldel", pr_celldel);
+    LINK_COMMAND(game, "cellinit", pr_cellinit);
+    LINK_COMMAND(game, "cellmove", pr_cellmove);
+    LINK_COMMAND(game, "cellput", pr_cellput);
+    LINK_COMMAND(game, "celltop", pr_celltop);
+}
+
+// what is in the cell, top first, as a new list
+Tcl_Obj *cells_entids(struct game *game, int lvl, int x, int y) {
+    Tcl_Obj *list = Tcl_NewListObj(0, NULL);
+    if (game->map_cells == NULL) return list;
+    struct cell *cell = cell_at(game, lvl, x, y);
+    for (int i = 0; i < cell->count; i++)
+        Tcl_ListObjAppendElement(NULL, list,
+                                 Tcl_NewWideIntObj(cell->ents[i].entid));
+    return list;
+}
+
+void cells_free(struct game *game) {
+    if (game->map_cells == NULL) return;
+    size_t cells = (size_t) game->map_size_x * game->map_size_y;
+    for (int w = 0; w < game->map_size_w; w++) {
+        for (size_t i = 0; i < cells; i++) {
+            struct cell *cell = &game->map_cells[w][i];
+            for (int j = 0; j < cell->count; j++)
+                Tcl_DecrRefCount(cell->ents[j].interact);
+            free(cell->ents);
+        }
+        free(game->map_cells[w]);
+    }
+    free(game->map_cells);
+    game->map_cells = NULL;
+}
+
+// entid w x y - for an entity taken off the map
+static int pr_celldel(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    Tcl_WideInt entid;
+    int lvl, x, y;
+    assert(objc == 5);
+    if (game->map_cells == NULL) return TCL_OK; // cellinit not yet called
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_GetIntFromObj(interp, objv[2], &lvl);
+    Tcl_GetIntFromObj(interp, objv[3], &x);
+    Tcl_GetIntFromObj(interp, objv[4], &y);
+    struct cellent ent;
+    cell_del(cell_at(game, lvl, x, y), entid, &ent);
+    if (ent.interact == NULL) return TCL_OK; // not displayed
+    Tcl_DecrRefCount(ent.interact);
+    cell_top(game, lvl, x, y);
+    return TCL_OK;
+}
+
+// {w x y entid ch zlevel interact ...} - every displayed entity, once
+// initmap has sized the map
+static int pr_cellinit(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count;
+    Tcl_Obj **list;
+    assert(objc == 2);
+    assert(game->map_chars != NULL);
+    cells_free(game);
+
+    size_t cells = (size_t) game->map_size_x * game->map_size_y;
+    if ((game->map_cells = malloc(sizeof(struct cell *) *
+                                  game->map_size_w)) == NULL)
+        oom();
+    for (int w = 0; w < game->map_size_w; w++)
+        if ((game->map_cells[w] = calloc(cells, sizeof(struct cell))) ==
+            NULL)
+            oom();
+
+    Tcl_ListObjGetElements(interp, objv[1], &count, &list);
+    assert(count % 7 == 0);
+    for (int i = 0; i < count; i += 7) {
+        int lvl, x, y;
+        struct cellent ent;
+        Tcl_GetIntFromObj(interp, list[i], &lvl);
+        Tcl_GetIntFromObj(interp, list[i + 1], &x);
+        Tcl_GetIntFromObj(interp, list[i + 2], &y);
+        Tcl_GetWideIntFromObj(interp, list[i + 3], &ent.entid);
+        Tcl_GetIntFromObj(interp, list[i + 4], &ent.ch);
+        Tcl_GetIntFromObj(interp, list[i + 5], &ent.zlevel);
+        assert(isprint(ent.ch));
+        ent.interact = list[i + 6];
+        Tcl_IncrRefCount(ent.interact);
+        cell_put(cell_at(game, lvl, x, y), &ent);
+    }
+    for (int w = 0; w < game->map_size_w; w++)
+        for (int x = 0; x < game->map_size_x; x++)
+            for (int y = 0; y < game->map_size_y; y++)
+                cell_top(game, w, x, y);
+    return TCL_OK;
+}
+
+// entid oldw oldx oldy neww newx newy
+static int pr_cellmove(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    Tcl_WideInt entid;
+    int oldw, oldx, oldy, neww, newx, newy;
+    assert(objc == 8);
+    if (game->map_cells == NULL) return TCL_OK; // cellinit not yet called
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_GetIntFromObj(interp, objv[2], &oldw);
+    Tcl_GetIntFromObj(interp, objv[3], &oldx);
+    Tcl_GetIntFromObj(interp, objv[4], &oldy);
+    Tcl_GetIntFromObj(interp, objv[5], &neww);
+    Tcl_GetIntFromObj(interp, objv[6], &newx);
+    Tcl_GetIntFromObj(interp, objv[7], &newy);
+    struct cellent ent;
+    cell_del(cell_at(game, oldw, oldx, oldy), entid, &ent);
+    if (ent.interact == NULL) return TCL_OK; // not displayed
+    cell_top(game, oldw, oldx, oldy);
+    cell_put(cell_at(game, neww, newx, newy), &ent);
+    cell_top(game, neww, newx, newy);
+    events_moved(game, entid, oldw, oldx, oldy, neww, newx, newy);
+    light_moved(game, entid, neww, newx, newy);
+    return TCL_OK;
+}
+
+// w x y entid ch zlevel interact - for an entity placed after cellinit
+static int pr_cellput(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int lvl, x, y;
+    struct cellent ent;
+    assert(objc == 8);
+    if (game->map_cells == NULL) return TCL_OK; // cellinit not yet called
+    Tcl_GetIntFromObj(interp, objv[1], &lvl);
+    Tcl_GetIntFromObj(interp, objv[2], &x);
+    Tcl_GetIntFromObj(interp, objv[3], &y);
+    Tcl_GetWideIntFromObj(interp, objv[4], &ent.entid);
+    Tcl_GetIntFromObj(interp, objv[5], &ent.ch);
+    Tcl_GetIntFromObj(interp, objv[6], &ent.zlevel);
+    assert(isprint(ent.ch));
+    ent.interact = objv[7];
+    Tcl_IncrRefCount(ent.interact);
+    cell_put(cell_at(game, lvl, x, y), &ent);
+    cell_top(game, lvl, x, y);
+    return TCL_OK;
+}
+
+// w x y - the entid and interact of the topmost entity in the cell, or
+// an empty list
+static int pr_celltop(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int lvl, x, y;
+    assert(objc == 4);
+    assert(game->map_cells != NULL);
+    Tcl_GetIntFromObj(interp, objv[1], &lvl);
+    Tcl_GetIntFromObj(interp, objv[2], &x);
+    Tcl_GetIntFromObj(interp, objv[3], &y);
+    struct cell *cell = cell_at(game, lvl, x, y);
+    if (!cell->count) return TCL_OK;
+    Tcl_Obj *top[2] = {Tcl_NewWideIntObj(cell->ents[0].entid),
+                       cell->ents[0].interact};
+    Tcl_SetObjResult(interp, Tcl_NewListObj(2, top));
+    return TCL_OK;
+}
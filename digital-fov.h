@@ -21,12 +21,27 @@
 
 /* Line Of Sight
  * runs at O(N)
+ * does not allocate unless (bx, by) is more than 64 grids away
  * return non-zero if the grid (bx, by) can be seen from the grid (ax, ay),
  * 0 otherwise
  */
 int digital_los(int **map, int map_size_x, int map_size_y,
                 int ax, int ay, int bx, int by);
 
+/* Line Of Sight from one grid to many
+ * targets is count (x, y) pairs; seen[i] is set to what digital_los
+ * would return for the i-th target
+ * the source checks and the working memory are shared by all the
+ * targets; when there are many targets for how far away they are,
+ * one digital_fov out to the farthest of them answers all of them
+ * this does not allocate unless a target is more than 64 grids away
+ * (or, for the FOV, more than MAX_FOV_RADIUS)
+ * return the number of targets that can be seen
+ */
+int digital_los_batch(int **map, int map_size_x, int map_size_y,
+                      int ax, int ay, int count, const int *targets,
+                      int *seen);
+
 /* map_fov must be a 2-dimension array of size
  * (2 * radius + 1, 2 * radius + 1).
  * The caller of the function must allocate enough memory to map_fov
@@ -0,0 +1,60 @@
+# eventcheck.tcl - drops the player down the chute onto a level that
+# is behind in time and has something burning where they land, and
+# fails unless the burning the catch up set off was dispatched before
+# they arrived (so it did not hit them) rather than after
+#
+#   ./prentice -n -b eventcheck.tcl
+
+# no catching up of the level below but by the drop
+set lod(nearby) 1000
+
+set_component 1 solid
+catch {move_ent 1 0 0 1 0 6 3 0}
+set fire [make_entity "a burning cloud" 1 7 3 ^ $zlevel(floor) \
+  act_okay energy burning]
+statset $fire 1 3 0
+
+# the cells effect_burning was called on during a catch up, and who
+# was in them
+set catching 0
+set burned {}
+rename catch_up real_catch_up
+proc catch_up {lvl limit} {
+    global catching
+    incr catching
+    try {real_catch_up $lvl $limit} finally {incr catching -1}
+}
+rename effect_burning real_effect_burning
+proc effect_burning {w x y events occupants} {
+    global burned catching
+    if {$catching} {lappend burned $w $x $y $occupants}
+    real_effect_burning $w $x $y $events $occupants
+}
+
+# l into the chute at 7,3 (on turn 1) and then look at where that left
+# the player
+proc getch {} {
+    global turn
+    if {$turn == 1} {return 108}
+    error done
+}
+catch {use_energy}
+
+set failed 0
+set where [ecs eval {SELECT w,x,y FROM position WHERE entid=1}]
+if {$where ne {1 7 3}} {
+    puts "FAIL player at $where, not down the chute at 1 7 3"
+    incr failed
+}
+if {![llength $burned]} {
+    puts "FAIL nothing burned while the level below caught up"
+    incr failed
+}
+foreach {w x y occupants} $burned {
+    if {1 in $occupants} {
+        puts "FAIL catch up burning at $w,$x,$y hit the player"
+        incr failed
+    }
+}
+puts "[expr {[llength $burned] / 4}] catch up burns, $failed failed"
+if {$failed} {exit 1}
@@ -0,0 +1,268 @@
+/* event queue - things that happen to a cell (something entering or
+ * leaving it, being interacted with, or a status effect ticking there)
+ * are queued over a turn and then dispatched all at once: handlers in
+ * priority order, and for each handler every cell with events of its
+ * type, once per cell however many events there were. so a burning
+ * cloud can burn whatever is in its cell before a chute drops them,
+ * and hundreds of effects are one ordered pass. each call is handed
+ * what is in the cell by way of the cell stacks, not SQL */
+
+#include "prentice.h"
+
+// events posted by handlers are dispatched in another round; after this
+// many rounds (of one eventrun) any left over wait for the next
+#define EVENT_ROUNDS 16
+
+enum { EVENT_ENTER, EVENT_INTERACT, EVENT_LEAVE, EVENT_TICK, EVENT_TYPES };
+static const char *Event_Names[] = {"enter", "interact", "leave", "tick",
+                                    NULL};
+
+struct event {
+    int type, lvl, x, y;
+    int seq; // posted order, within the cell
+    Tcl_WideInt entid;
+    Tcl_Obj *data; // may be NULL
+};
+
+struct handler {
+    int type, priority;
+    Tcl_Obj *cmd; // prefix, to which w x y events occupants are added
+};
+
+struct events {
+    struct event *queue;
+    int count, size, seq;
+    struct handler *handlers; // highest priority first
+    int handler_count, handler_size;
+    int handled[EVENT_TYPES]; // handlers of each type
+    int running; // eventrun depth
+};
+
+static int event_cmp(const void *a, const void *b);
+static void event_free(struct event *batch, int count);
+static int event_post(struct game *game, int type, int lvl, int x, int y,
+                      Tcl_WideInt entid, Tcl_Obj *data);
+static int event_type(Tcl_Interp *interp, Tcl_Obj *obj, int *type);
+static int pr_eventon(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_eventpost(ClientData clientData, Tcl_Interp *interp, int objc,
+                        Tcl_Obj *CONST objv[]);
+static int pr_eventrun(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int run_batch(struct game *game, struct event *batch, int count);
+
+// by type and cell, so each handler's cells are in one run
+static int event_cmp(const void *a, const void *b) {
+    const struct event *ea = a, *eb = b;
+    if (ea->type != eb->type) return ea->type - eb->type;
+    if (ea->lvl != eb->lvl) return ea->lvl - eb->lvl;
+    if (ea->x != eb->x) return ea->x - eb->x;
+    if (ea->y != eb->y) return ea->y - eb->y;
+    return ea->seq - eb->seq;
+}
+
+static void event_free(struct event *batch, int count) {
+    for (int i = 0; i < count; i++)
+        if (batch[i].data) Tcl_DecrRefCount(batch[i].data);
+    free(batch);
+}
+
+// returns whether the event was queued, which it is not if no handler
+// is for the type
+static int event_post(struct game *game, int type, int lvl, int x, int y,
+                      Tcl_WideInt entid, Tcl_Obj *data) {
+    struct events *ev = game->events;
+    assert(type >= 0 && type < EVENT_TYPES);
+    if (!ev->handled[type]) return 0;
+    if (ev->count == ev->size) {
+        ev->size = ev->size ? ev->size * 2 : 64;
+        if ((ev->queue = realloc(ev->queue, sizeof(struct event) *
+                                                ev->size)) == NULL)
+            oom();
+    }
+    struct event *e = &ev->queue[ev->count++];
+    e->type         = type;
+    e->lvl          = lvl;
+    e->x            = x;
+    e->y            = y;
+    e->seq          = ev->seq++;
+    e->entid        = entid;
+    e->data         = data;
+    if (data) Tcl_IncrRefCount(data);
+    return 1;
+}
+
+inline static int event_type(Tcl_Interp *interp, Tcl_Obj *obj, int *type) {
+    return Tcl_GetIndexFromObj(interp, obj, Event_Names, "event type", 0,
+                               type);
+}
+
+void events_commands(struct game *game) {
+    if ((game->events = calloc(1, sizeof(struct events))) == NULL) oom();
+    LINK_COMMAND(game, "eventon", pr_eventon);
+    LINK_COMMAND(game, "eventpost", pr_eventpost);
+    LINK_COMMAND(game, "eventrun", pr_eventrun);
+}
+
+void events_free(struct game *game) {
+    struct events *ev = game->events;
+    event_free(ev->queue, ev->count);
+    for (int i = 0; i < ev->handler_count; i++)
+        Tcl_DecrRefCount(ev->handlers[i].cmd);
+    free(ev->handlers);
+    free(ev);
+}
+
+// from cellmove, for anything displayed; nothing is queued unless some
+// handler wants it
+void events_moved(struct game *game, Tcl_WideInt entid, int oldw, int oldx,
+                  int oldy, int neww, int newx, int newy) {
+    event_post(game, EVENT_LEAVE, oldw, oldx, oldy, entid, NULL);
+    event_post(game, EVENT_ENTER, neww, newx, newy, entid, NULL);
+}
+
+// type priority handler - handler (a command prefix) is called with w x
+// y {entid data ...} {occupant ...} for each cell with events of the
+// type; higher priorities go first, and equal ones in the order they
+// were added
+static int pr_eventon(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game  = clientData;
+    struct events *ev  = game->events;
+    int type, priority;
+    assert(objc == 4);
+    if (event_type(interp, objv[1], &type) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[2], &priority) != TCL_OK)
+        return TCL_ERROR;
+    if (ev->running) {
+        Tcl_SetObjResult(interp,
+                         Tcl_NewStringObj("eventon during eventrun", -1));
+        return TCL_ERROR;
+    }
+    if (ev->handler_count == ev->handler_size) {
+        ev->handler_size = ev->handler_size ? ev->handler_size * 2 : 8;
+        if ((ev->handlers = realloc(ev->handlers, sizeof(struct handler) *
+                                                      ev->handler_size)) ==
+            NULL)
+            oom();
+    }
+    int i = ev->handler_count++;
+    while (i > 0 && ev->handlers[i - 1].priority < priority) {
+        ev->handlers[i] = ev->handlers[i - 1];
+        i--;
+    }
+    ev->handlers[i].type     = type;
+    ev->handlers[i].priority = priority;
+    ev->handlers[i].cmd      = objv[3];
+    Tcl_IncrRefCount(objv[3]);
+    ev->handled[type]++;
+    return TCL_OK;
+}
+
+// type w x y entid ?data? - queues the event for the next eventrun;
+// returns whether there was a handler for it
+static int pr_eventpost(ClientData clientData, Tcl_Interp *interp,
+                        int objc, Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int type, lvl, x, y;
+    Tcl_WideInt entid;
+    assert(objc == 6 || objc == 7);
+    if (event_type(interp, objv[1], &type) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[2], &lvl) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[3], &x) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[4], &y) != TCL_OK ||
+        Tcl_GetWideIntFromObj(interp, objv[5], &entid) != TCL_OK)
+        return TCL_ERROR;
+    int queued = event_post(game, type, lvl, x, y, entid,
+                            objc == 7 ? objv[6] : NULL);
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(queued));
+    return TCL_OK;
+}
+
+// dispatches everything queued, and what that queues in turn (up to
+// EVENT_ROUNDS times); returns how many handler calls there were. a
+// handler may run it too (a chute drop catches up the level below by
+// way of move_ent) and then everything queued so far is dispatched in
+// rounds of its own before the handler goes on, so what the catch up
+// set off has happened by the time anything arrives
+static int pr_eventrun(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    struct events *ev = game->events;
+    int calls = 0;
+    ev->running++;
+    for (int round = 0; ev->count; round++) {
+        if (round == EVENT_ROUNDS) {
+            log_msg(LOG_WARN, "%d events left after %d rounds", ev->count,
+                    EVENT_ROUNDS);
+            break;
+        }
+        // handlers post to a new queue
+        struct event *batch = ev->queue;
+        int count           = ev->count;
+        ev->queue           = NULL;
+        ev->count = ev->size = 0;
+        int ret = run_batch(game, batch, count);
+        event_free(batch, count);
+        if (ret < 0) {
+            ev->running--;
+            return TCL_ERROR;
+        }
+        calls += ret;
+    }
+    ev->running--;
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(calls));
+    return TCL_OK;
+}
+
+// the handler calls made, or -1 on error
+static int run_batch(struct game *game, struct event *batch, int count) {
+    struct events *ev  = game->events;
+    Tcl_Interp *interp = game->interp;
+    int calls = 0, first[EVENT_TYPES + 1];
+    qsort(batch, count, sizeof(struct event), event_cmp);
+    for (int type = 0, i = 0; type <= EVENT_TYPES; type++) {
+        while (i < count && batch[i].type < type)
+            i++;
+        first[type] = i;
+    }
+    for (int h = 0; h < ev->handler_count; h++) {
+        struct handler *handler = &ev->handlers[h];
+        int end = first[handler->type + 1], prefix;
+        Tcl_Obj **words;
+        Tcl_ListObjGetElements(NULL, handler->cmd, &prefix, &words);
+        for (int i = first[handler->type], j; i < end; i = j) {
+            struct event *e = &batch[i];
+            Tcl_Obj *events = Tcl_NewListObj(0, NULL);
+            for (j = i; j < end && batch[j].lvl == e->lvl &&
+                        batch[j].x == e->x && batch[j].y == e->y;
+                 j++) {
+                Tcl_ListObjAppendElement(NULL, events,
+                                         Tcl_NewWideIntObj(batch[j].entid));
+                Tcl_ListObjAppendElement(NULL, events, batch[j].data
+                                                           ? batch[j].data
+                                                           : Tcl_NewObj());
+            }
+            Tcl_Obj *stackv[16], **argv = stackv;
+            int argc = prefix + 5;
+            if (argc > 16)
+                argv = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * argc);
+            for (int k = 0; k < prefix; k++)
+                argv[k] = words[k];
+            argv[prefix]     = Tcl_NewIntObj(e->lvl);
+            argv[prefix + 1] = Tcl_NewIntObj(e->x);
+            argv[prefix + 2] = Tcl_NewIntObj(e->y);
+            argv[prefix + 3] = events;
+            argv[prefix + 4] = cells_entids(game, e->lvl, e->x, e->y);
+            for (int k = prefix; k < argc; k++)
+                Tcl_IncrRefCount(argv[k]);
+            int ret = Tcl_EvalObjv(interp, argc, argv, TCL_EVAL_GLOBAL);
+            for (int k = prefix; k < argc; k++)
+                Tcl_DecrRefCount(argv[k]);
+            if (argv != stackv) ckfree((char *) argv);
+            if (ret == TCL_ERROR) return -1;
+            calls++;
+        }
+    }
+    return calls;
+}
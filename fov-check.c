@@ -0,0 +1,231 @@
+/* fov-check - differential test of the FOV code. random wall maps are
+ * made with the JSF RNG and the output of each FOV engine is compared
+ * cell for cell with digital_los run from the center to every cell in
+ * the radius, this being the definition in digital-fov.h. a failure is
+ * shrunk to as few walls as still show it and printed as a map.
+ * digital_los_batch is held to digital_los in the same way
+ *
+ *   ./fov-check [-n iterations] [-s seed] */
+
+#include "digital-fov.h"
+#include "prentice.h"
+
+#define MAX_MAP_SIZE 40
+
+typedef int (*fov_fn)(int **map, int map_size_x, int map_size_y,
+                      int **map_fov, int center_x, int center_y,
+                      int radius);
+
+struct trial {
+    int **map, size_x, size_y;
+    int center_x, center_y, radius;
+};
+
+static int **Expect, **Got;
+static int Targets[2 * (2 * MAX_FOV_RADIUS + 1) * (2 * MAX_FOV_RADIUS + 1)],
+    Seen[(2 * MAX_FOV_RADIUS + 1) * (2 * MAX_FOV_RADIUS + 1)];
+
+static int **alloc_grid(int size_x, int size_y);
+static int batch_fov(int **map, int map_size_x, int map_size_y,
+                     int **map_fov, int center_x, int center_y, int radius);
+static int compare(fov_fn fov, struct trial *t, int *bad_x, int *bad_y);
+static int column_fov(int **map, int map_size_x, int map_size_y,
+                      int **map_fov, int center_x, int center_y, int radius);
+static void draw(struct trial *t, int bad_x, int bad_y);
+static void shrink(fov_fn fov, struct trial *t);
+
+// new engines go here and must agree with digital_los everywhere
+static struct {
+    const char *name;
+    fov_fn fov;
+} Engines[] = {{"digital_fov", digital_fov},
+               {"digital_los_batch", batch_fov},
+               {"digital_los_batch columns", column_fov},
+               {NULL, NULL}};
+
+static int **alloc_grid(int size_x, int size_y) {
+    int **grid;
+    if ((grid = malloc(sizeof(int *) * size_x)) == NULL) oom();
+    if ((grid[0] = calloc(size_x * size_y, sizeof(int))) == NULL) oom();
+    for (int x = 1; x < size_x; x++)
+        grid[x] = grid[0] + x * size_y;
+    return grid;
+}
+
+// FOV by way of digital_los_batch, for every cell in the radius
+static int batch_fov(int **map, int map_size_x, int map_size_y,
+                     int **map_fov, int center_x, int center_y, int radius) {
+    int count = 0;
+    for (int x = center_x - radius; x <= center_x + radius; x++) {
+        for (int y = center_y - radius; y <= center_y + radius; y++) {
+            Targets[2 * count]     = x;
+            Targets[2 * count + 1] = y;
+            count++;
+        }
+    }
+    digital_los_batch(map, map_size_x, map_size_y, center_x, center_y,
+                      count, Targets, Seen);
+    for (int i = 0; i < count; i++)
+        map_fov[Targets[2 * i] - center_x + radius]
+               [Targets[2 * i + 1] - center_y + radius] = Seen[i];
+    return 0;
+}
+
+// returns non-zero and the first differing map cell if the engine and
+// digital_los disagree. cells off the map are never visible
+static int compare(fov_fn fov, struct trial *t, int *bad_x, int *bad_y) {
+    int r = t->radius;
+    for (int x = t->center_x - r; x <= t->center_x + r; x++) {
+        for (int y = t->center_y - r; y <= t->center_y + r; y++) {
+            int *expect = &Expect[x - t->center_x + r][y - t->center_y + r];
+            if (x < 0 || x >= t->size_x || y < 0 || y >= t->size_y)
+                *expect = 0;
+            else
+                *expect = digital_los(t->map, t->size_x, t->size_y,
+                                      t->center_x, t->center_y, x, y) != 0;
+        }
+    }
+    if (fov(t->map, t->size_x, t->size_y, Got, t->center_x, t->center_y,
+            r) != 0) {
+        *bad_x = t->center_x;
+        *bad_y = t->center_y;
+        return 1;
+    }
+    for (int x = 0; x <= 2 * r; x++) {
+        for (int y = 0; y <= 2 * r; y++) {
+            if ((Got[x][y] != 0) != Expect[x][y]) {
+                *bad_x = x + t->center_x - r;
+                *bad_y = y + t->center_y - r;
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+// @ is the center, # a wall, ! the cell in dispute, and . and - the
+// floor in and out of the radius
+// as batch_fov, but a column of targets at a time, which is too few
+// for digital_los_batch to do a FOV for them
+static int column_fov(int **map, int map_size_x, int map_size_y,
+                      int **map_fov, int center_x, int center_y, int radius) {
+    for (int x = center_x - radius; x <= center_x + radius; x++) {
+        int count = 0;
+        for (int y = center_y - radius; y <= center_y + radius; y++) {
+            Targets[2 * count]     = x;
+            Targets[2 * count + 1] = y;
+            count++;
+        }
+        digital_los_batch(map, map_size_x, map_size_y, center_x, center_y,
+                          count, Targets, Seen);
+        for (int i = 0; i < count; i++)
+            map_fov[x - center_x + radius][i] = Seen[i];
+    }
+    return 0;
+}
+
+static void draw(struct trial *t, int bad_x, int bad_y) {
+    printf("map %dx%d center %d,%d radius %d, cell %d,%d is %s by "
+           "digital_los\n",
+           t->size_x, t->size_y, t->center_x, t->center_y, t->radius, bad_x,
+           bad_y,
+           Expect[bad_x - t->center_x + t->radius]
+                 [bad_y - t->center_y + t->radius]
+               ? "seen"
+               : "not seen");
+    for (int y = 0; y < t->size_y; y++) {
+        for (int x = 0; x < t->size_x; x++) {
+            if (x == t->center_x && y == t->center_y)
+                putchar('@');
+            else if (x == bad_x && y == bad_y)
+                putchar('!');
+            else if (t->map[x][y])
+                putchar('#');
+            else if (abs(x - t->center_x) <= t->radius &&
+                     abs(y - t->center_y) <= t->radius)
+                putchar('.');
+            else
+                putchar('-');
+        }
+        putchar('\n');
+    }
+}
+
+// the digital FOV code calls oom() on malloc failure
+void fatal(const char *const fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+// removes walls one at a time, keeping the removal if the engine still
+// disagrees, until no single wall can go
+static void shrink(fov_fn fov, struct trial *t) {
+    int bad_x, bad_y, removed;
+    do {
+        removed = 0;
+        for (int x = 0; x < t->size_x; x++) {
+            for (int y = 0; y < t->size_y; y++) {
+                if (!t->map[x][y]) continue;
+                t->map[x][y] = 0;
+                if (compare(fov, t, &bad_x, &bad_y))
+                    removed = 1;
+                else
+                    t->map[x][y] = 1;
+            }
+        }
+    } while (removed);
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = 100000;
+    uint32_t seed   = (uint32_t) time(NULL);
+    int ch;
+    while ((ch = getopt(argc, argv, "n:s:")) != -1) {
+        switch (ch) {
+        case 'n': iterations = strtol(optarg, NULL, 10); break;
+        case 's': seed = (uint32_t) strtoul(optarg, NULL, 10); break;
+        default:
+            fputs("Usage: ./fov-check [-n iterations] [-s seed]\n", stderr);
+            exit(EX_USAGE);
+        }
+    }
+    printf("fov-check seed %lu\n", (unsigned long) seed);
+    raninit(seed);
+
+    struct trial t;
+    t.map  = alloc_grid(MAX_MAP_SIZE, MAX_MAP_SIZE);
+    Expect = alloc_grid(2 * MAX_FOV_RADIUS + 1, 2 * MAX_FOV_RADIUS + 1);
+    Got    = alloc_grid(2 * MAX_FOV_RADIUS + 1, 2 * MAX_FOV_RADIUS + 1);
+
+    int failures = 0;
+    for (long i = 0; i < iterations; i++) {
+        // maps smaller than the radius test the edge handling
+        t.size_x   = 1 + ranval() % MAX_MAP_SIZE;
+        t.size_y   = 1 + ranval() % MAX_MAP_SIZE;
+        t.center_x = ranval() % t.size_x;
+        t.center_y = ranval() % t.size_y;
+        t.radius   = ranval() % (MAX_FOV_RADIUS + 1);
+        uint32_t density = ranval() % 70;
+        // lay the rows out for the size of this map
+        for (int x = 0; x < t.size_x; x++)
+            t.map[x] = t.map[0] + x * t.size_y;
+        for (int x = 0; x < t.size_x; x++)
+            for (int y = 0; y < t.size_y; y++)
+                t.map[x][y] = ranval() % 100 < density;
+
+        for (int e = 0; Engines[e].name != NULL; e++) {
+            int bad_x, bad_y;
+            if (!compare(Engines[e].fov, &t, &bad_x, &bad_y)) continue;
+            printf("FAIL %s iteration %ld\n", Engines[e].name, i);
+            shrink(Engines[e].fov, &t);
+            compare(Engines[e].fov, &t, &bad_x, &bad_y);
+            draw(&t, bad_x, bad_y);
+            if (++failures >= 10) exit(1);
+        }
+    }
+    printf("%ld maps, %d failures\n", iterations, failures);
+    exit(failures ? 1 : EXIT_SUCCESS);
+}
@@ -0,0 +1,175 @@
+/* FOV cache - the last FOV worked out for each viewing entity is kept
+ * until the entity moves or the wall map changes at a cell the FOV
+ * depends on. those cells are the visible ones; a wall coming or
+ * going out of sight cannot change what is seen as any line of sight
+ * to a visible cell only passes over other visible cells */
+
+#include "digital-fov.h"
+#include "prentice.h"
+
+struct fov {
+    int lvl, x, y, radius;
+    int valid;
+    int **grid; // (2 * MAX_FOV_RADIUS + 1) squared, as for digital_fov
+};
+
+static void fov_delete(struct fov *fov);
+static struct fov *fov_new(void);
+static int pr_fov(ClientData clientData, Tcl_Interp *interp, int objc,
+                  Tcl_Obj *CONST objv[]);
+static int pr_fov_forget(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]);
+static int pr_mapwall(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+
+void fov_commands(struct game *game) {
+    // entid to struct fov
+    Tcl_InitHashTable(&game->fov_cache, TCL_ONE_WORD_KEYS);
+    LINK_COMMAND(game, "fov", pr_fov);
+    LINK_COMMAND(game, "fov_forget", pr_fov_forget);
+    LINK_COMMAND(game, "mapwall", pr_mapwall);
+}
+
+static void fov_delete(struct fov *fov) {
+    free(fov->grid[0]);
+    free(fov->grid);
+    free(fov);
+}
+
+// the FOV for the entity at the given location, worked out again only
+// if need be
+int **fov_for(struct game *game, Tcl_WideInt entid, int lvl, int x, int y,
+              int radius) {
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    assert(radius > 0 && radius <= MAX_FOV_RADIUS);
+    int isnew;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(
+        &game->fov_cache, (char *) (intptr_t) entid, &isnew);
+    struct fov *fov;
+    if (isnew) {
+        fov = fov_new();
+        Tcl_SetHashValue(entry, fov);
+    } else {
+        fov = Tcl_GetHashValue(entry);
+        if (fov->valid && fov->lvl == lvl && fov->x == x && fov->y == y &&
+            fov->radius == radius)
+            return fov->grid;
+    }
+    uint64_t start = timing_now();
+    digital_fov(game->map_walls[lvl], game->map_size_x, game->map_size_y,
+                fov->grid, x, y, radius);
+    if (!game->hosted) timing_add(TIME_FOV, start);
+    fov->lvl    = lvl;
+    fov->x      = x;
+    fov->y      = y;
+    fov->radius = radius;
+    fov->valid  = 1;
+    return fov->grid;
+}
+
+void fov_forget(struct game *game, Tcl_WideInt entid) {
+    Tcl_HashEntry *entry =
+        Tcl_FindHashEntry(&game->fov_cache, (char *) (intptr_t) entid);
+    if (entry == NULL) return;
+    fov_delete(Tcl_GetHashValue(entry));
+    Tcl_DeleteHashEntry(entry);
+}
+
+void fov_free(struct game *game) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&game->fov_cache, &search);
+    for (; entry != NULL; entry = Tcl_NextHashEntry(&search))
+        fov_delete(Tcl_GetHashValue(entry));
+    Tcl_DeleteHashTable(&game->fov_cache);
+}
+
+static struct fov *fov_new(void) {
+    struct fov *fov;
+    int size = 2 * MAX_FOV_RADIUS + 1;
+    if ((fov = calloc(1, sizeof(struct fov))) == NULL) oom();
+    if ((fov->grid = malloc(sizeof(int *) * size)) == NULL) oom();
+    if ((fov->grid[0] = calloc(size * size, sizeof(int))) == NULL) oom();
+    for (int i = 1; i < size; i++)
+        fov->grid[i] = fov->grid[0] + i * size;
+    return fov;
+}
+
+// sets whether the cell blocks sight, invalidating the FOVs that can
+// see it if that changed
+void fov_wall(struct game *game, int lvl, int x, int y, int wall) {
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    wall = wall != 0;
+    if (game->map_walls[lvl][x][y] == wall) return;
+    game->map_walls[lvl][x][y] = wall;
+    light_wall(game, lvl, x, y);
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&game->fov_cache, &search);
+    for (; entry != NULL; entry = Tcl_NextHashEntry(&search)) {
+        struct fov *fov = Tcl_GetHashValue(entry);
+        int dx = x - fov->x + fov->radius, dy = y - fov->y + fov->radius;
+        if (fov->valid && fov->lvl == lvl && dx >= 0 &&
+            dx <= 2 * fov->radius && dy >= 0 && dy <= 2 * fov->radius &&
+            fov->grid[dx][dy])
+            fov->valid = 0;
+    }
+}
+
+// entid w,x,y radius - what the entity can see, as a list of x y pairs
+static int pr_fov(ClientData clientData, Tcl_Interp *interp, int objc,
+                  Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, entx, enty, radius;
+    Tcl_WideInt entid;
+    Tcl_Obj **list;
+    assert(objc == 4);
+    assert(game->map_walls != NULL);
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_ListObjGetElements(interp, objv[2], &count, &list);
+    assert(count == 3);
+    Tcl_GetIntFromObj(interp, list[0], &lvl);
+    Tcl_GetIntFromObj(interp, list[1], &entx);
+    Tcl_GetIntFromObj(interp, list[2], &enty);
+    Tcl_GetIntFromObj(interp, objv[3], &radius);
+
+    int **grid    = fov_for(game, entid, lvl, entx, enty, radius);
+    Tcl_Obj *seen = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i <= 2 * radius; i++) {
+        for (int j = 0; j <= 2 * radius; j++) {
+            if (!grid[i][j]) continue;
+            Tcl_ListObjAppendElement(interp, seen,
+                                     Tcl_NewIntObj(entx - radius + i));
+            Tcl_ListObjAppendElement(interp, seen,
+                                     Tcl_NewIntObj(enty - radius + j));
+        }
+    }
+    Tcl_SetObjResult(interp, seen);
+    return TCL_OK;
+}
+
+static int pr_fov_forget(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_WideInt entid;
+    assert(objc == 2);
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    fov_forget(clientData, entid);
+    return TCL_OK;
+}
+
+// w x y is-wall? - for when an opaque entity enters or leaves a cell
+static int pr_mapwall(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int lvl, x, y, wall;
+    assert(objc == 5);
+    if (game->map_walls == NULL) return TCL_OK; // initmap not yet called
+    Tcl_GetIntFromObj(interp, objv[1], &lvl);
+    Tcl_GetIntFromObj(interp, objv[2], &x);
+    Tcl_GetIntFromObj(interp, objv[3], &y);
+    Tcl_GetBooleanFromObj(interp, objv[4], &wall);
+    fov_wall(game, lvl, x, y, wall);
+    return TCL_OK;
+}
@@ -0,0 +1,83 @@
+/* games - the interpreter, ECS database, map, and messages of one game.
+ * Game (see main.c) is the one on the screen; host.c runs many more,
+ * one interpreter per thread at a time */
+
+#include "prentice.h"
+
+// init.tcl, one string per line (see the init.h rule in the Makefile)
+static const char *const Init_Tcl[] = {
+#include "init.h"
+    NULL};
+
+void game_free(struct game *game) {
+    Tcl_DeleteInterp(game->interp);
+    cells_free(game);
+    events_free(game);
+    fov_free(game);
+    keys_free(game);
+    light_free(game);
+    map_free(game);
+    message_free(game);
+    path_free(game);
+    stats_free(game);
+    free(game);
+}
+
+// runs init.tcl, which makes (or loads from dbfile) the ECS database;
+// autosave is how many turns apart to save it, or 0. returns TCL_OK or
+// the error code with the stack trace in errorInfo
+int game_init(struct game *game, const char *dbfile, int savedb,
+              int autosave, int warmup) {
+    Tcl_Interp *interp = game->interp;
+    Tcl_SetVar2(interp, "dbfile", NULL, dbfile ? dbfile : "", 0);
+    Tcl_SetVar2Ex(interp, "savedb", NULL, Tcl_NewBooleanObj(savedb), 0);
+    Tcl_SetVar2Ex(interp, "autosave", NULL, Tcl_NewIntObj(autosave), 0);
+    Tcl_SetVar2Ex(interp, "warmup", NULL, Tcl_NewBooleanObj(warmup), 0);
+    Tcl_Obj *script = Tcl_NewObj();
+    Tcl_IncrRefCount(script);
+    for (const char *const *line = Init_Tcl; *line != NULL; line++)
+        Tcl_AppendToObj(script, *line, -1);
+    int ret = Tcl_EvalObjEx(interp, script, TCL_EVAL_GLOBAL);
+    Tcl_DecrRefCount(script);
+    return ret;
+}
+
+// a new interpreter with the game commands linked to it; the caller
+// adds getch and startup_phase
+struct game *game_new(int hosted) {
+    struct game *game;
+    if ((game = calloc(1, sizeof(struct game))) == NULL) oom();
+    game->hosted = hosted;
+    if ((game->interp = Tcl_CreateInterp()) == NULL)
+        errx(EX_OSERR, "Tcl_CreateInterp failed");
+    Tcl_Interp *interp = game->interp;
+#ifdef TCLSQLITE_LIB
+    // skip the library search of Tcl_Init and load sqlite3 directly
+    Tcl_Obj *load = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(load);
+    Tcl_ListObjAppendElement(NULL, load, Tcl_NewStringObj("load", -1));
+    Tcl_ListObjAppendElement(NULL, load, Tcl_NewStringObj(TCLSQLITE_LIB, -1));
+    Tcl_ListObjAppendElement(NULL, load, Tcl_NewStringObj("Sqlite3", -1));
+    if (Tcl_EvalObjEx(interp, load, TCL_EVAL_GLOBAL) != TCL_OK)
+        errx(EX_OSERR, "load %s failed: %s", TCLSQLITE_LIB,
+             Tcl_GetStringResult(interp));
+    Tcl_DecrRefCount(load);
+#else
+    if (Tcl_Init(interp) == TCL_ERROR) errx(EX_OSERR, "Tcl_Init failed");
+#endif
+    Tcl_LinkVar(interp, "turn", (char *) &game->turn, TCL_LINK_WIDE_INT);
+    autosave_commands(game);
+    cells_commands(game);
+    events_commands(game);
+    fov_commands(game);
+    keys_commands(game);
+    light_commands(game);
+    log_commands(game);
+    map_commands(game);
+    message_commands(game);
+    path_commands(game);
+    profile_commands(game);
+    stats_commands(game);
+    timing_commands(game);
+    return game;
+}
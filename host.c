@@ -0,0 +1,82 @@
+/* hosted games - many headless games run by a pool of threads, for
+ * when the throughput of whole games matters more than any one screen.
+ * each game has its own interpreter and :memory: ECS database and only
+ * ever runs on the thread that made it
+ *
+ *   ./prentice -H 1000 -j 8 -b script.tcl
+ *
+ * the script is run in each game after init.tcl with game_index set,
+ * and must stand in for getch as there is no keyboard */
+
+#include <pthread.h>
+
+#include "prentice.h"
+
+static const char *Host_Script;
+static int Host_Count;
+static int Next_Game, Games_Failed; // shared by the workers
+
+static void *host_worker(void *unused);
+static int pr_getch(ClientData clientData, Tcl_Interp *interp, int objc,
+                    Tcl_Obj *CONST objv[]);
+static int pr_startup_phase(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]);
+
+// runs count games of the script over the given number of threads and
+// prints how many games per second that came to
+void host_run(const char *script, int count, int threads) {
+    pthread_t *workers;
+    assert(script != NULL);
+    Host_Script = script;
+    Host_Count  = count;
+    if (threads > count) threads = count;
+    if (threads < 1) threads = 1;
+    if ((workers = malloc(sizeof(pthread_t) * threads)) == NULL)
+        err(EX_OSERR, "malloc");
+    uint64_t start = timing_now();
+    for (int i = 0; i < threads; i++)
+        if ((errno = pthread_create(&workers[i], NULL, host_worker, NULL)))
+            err(EX_OSERR, "pthread_create");
+    for (int i = 0; i < threads; i++)
+        pthread_join(workers[i], NULL);
+    double secs = (timing_now() - start) / 1e9;
+    free(workers);
+    printf("hosted %d games %d failed %d threads %.6f s %.1f games/s\n",
+           count, Games_Failed, threads, secs,
+           secs > 0 ? count / secs : 0.0);
+}
+
+static void *host_worker(void *unused) {
+    int index;
+    while ((index = __atomic_fetch_add(&Next_Game, 1, __ATOMIC_RELAXED)) <
+           Host_Count) {
+        struct game *game = game_new(1);
+        LINK_COMMAND(game, "getch", pr_getch);
+        LINK_COMMAND(game, "startup_phase", pr_startup_phase);
+        Tcl_SetVar2Ex(game->interp, "game_index", NULL, Tcl_NewIntObj(index),
+                      0);
+        if (game_init(game, NULL, 0, 0, 0) != TCL_OK ||
+            Tcl_EvalFile(game->interp, Host_Script) != TCL_OK) {
+            const char *why = Tcl_GetVar2(game->interp, "errorInfo", NULL,
+                                          TCL_GLOBAL_ONLY);
+            if (why == NULL) why = Tcl_GetStringResult(game->interp);
+            log_msg(LOG_ERROR, "game %d failed: %s", index, why);
+            __atomic_fetch_add(&Games_Failed, 1, __ATOMIC_RELAXED);
+        }
+        game_free(game);
+    }
+    Tcl_FinalizeThread();
+    return NULL;
+}
+
+static int pr_getch(ClientData clientData, Tcl_Interp *interp, int objc,
+                    Tcl_Obj *CONST objv[]) {
+    Tcl_SetObjResult(interp,
+                     Tcl_NewStringObj("no keyboard in a hosted game", -1));
+    return TCL_ERROR;
+}
+
+static int pr_startup_phase(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]) {
+    return TCL_OK;
+}
@@ -5,28 +5,70 @@ package require Tcl 8.6
 package require sqlite3 3.23.0
 namespace path ::tcl::mathop
 sqlite3 ecs :memory: -create true -nomutex true
+# every eval site gets a timing histogram under its SQL text
+timing_wrap ecs
+# and, with -P, a frame in the profile
+profile_wrap ecs
+startup_phase sqlite3
+
+# ecs serialize, which autosave writes out from, is only in tclsqlite
+# 3.36 and later; before that saves are made in the foreground
+variable can_serialize \
+  [package vsatisfies [package present sqlite3] 3.36]
 
 # xmin,ymin,xmax,ymax,wmin,wmax dimensions of the "level map"
 variable boundary
 
+# count of use_energy ticks (this is linked to a C variable)
+variable turn
+
+# energy cost of the action the current entity took, see spend
+variable spent 0
+
 # higher values drawn in favor of lower ones in any given cell
 array set zlevel {floor 0 feature 1 item 10 monst 100 ekileugor 1000}
 
+# FOV radius of update_map; what is in view is only seen if it is lit
+# (see light.c), so this is how far off a lit thing can be made out
+variable sight 7
+
+# set while simulate runs
+set simulating 0
+
+# level of detail - tick runs the level the keyboard entity is on every
+# turn, the levels next to it every lod(nearby) turns, and leaves the
+# rest be until they are entered, when they catch up by at most
+# lod(catchup) moves. the time (energy spent) goes on in lod(now), and
+# synced has the time each level was last brought up to; they are in
+# step so long as the energy of a level is only ever taken down by the
+# time it has been behind
+array set lod {nearby 4 catchup 1000 now 0 active {}}
+array set synced {}
+
 # escape hatch, and unlike DCSS these only go down
+# onto the chute; the drop is made once everyone has moved, by
+# chute_drop, after anything of a higher priority has had its go
 proc act_chute {entv depth lvl oldx oldy newx newy cost destid} {
-    global ecs
     upvar $depth $entv ent
-    # TODO but need to see if the move is legal as something may be
-    # blocking the stair
-    tailcall move_ent $ent(entid) $depth \
-      $lvl $oldx $oldy [+ $lvl 1] $newx $newy [* 2 $cost]
+    eventpost interact $lvl $newx $newy $ent(entid) $destid
+    tailcall move_ent $ent(entid) \
+      $lvl $oldx $oldy $lvl $newx $newy [* 2 $cost]
 }
 
 # should this pass in a dict? this is getting crazy long
+#
+# a blow at whatever is in the way, so long as both have stats (see
+# stats.c); otherwise there is nothing to fight and no time is taken
 proc act_fight {entv depth lvl oldx oldy newx newy cost destid} {
-    # where is HP getting put--prolly table?
-    warn "TODO fight with $destid"
-    return -code continue
+    upvar $depth $entv ent
+    set hits [resolve_attacks [list $ent(entid) $destid]]
+    if {![llength $hits]} {
+        log debug "$ent(entid) cannot fight $destid"
+        return -code continue
+    }
+    report_hits $ent(entid) $hits
+    spend $cost
+    return -code break
 }
 
 proc act_missing {entv depth lvl oldx oldy newx newy cost destid} {
@@ -41,21 +83,122 @@ proc act_nope {entv depth lvl oldx oldy newx newy cost destid} {
 # action (move, really) is allowed
 proc act_okay {entv depth lvl oldx oldy newx newy cost destid} {
     upvar $depth $entv ent
-    tailcall move_ent $ent(entid) $depth \
+    tailcall move_ent $ent(entid) \
       $lvl $oldx $oldy $lvl $newx $newy $cost
 }
 
+# the level the keyboard entity is on, or -1 if there is none
+proc active_level {} {
+    global ecs
+    set lvl [ecs onecolumn {
+        SELECT w FROM position INNER JOIN components USING (entid)
+        WHERE comp='keyboard' LIMIT 1
+    }]
+    if {$lvl eq ""} {return -1}
+    return $lvl
+}
+
+# a save point: written in the background if autosave can, otherwise
+# by save_db
+proc autosave_db {} {
+    global can_serialize
+    if {!$can_serialize} {tailcall save_db}
+    stat_sync
+    autosave game.db
+}
+
 # move the cursor somewhere
 proc at {x y} {return \033\[$y\;${x}H}
 
 # move the cursor somewhere in the map (at an offset to the origin)
 proc at_map {x y} {return \033\[[+ 2 $y]\;[+ 2 $x]H}
 
+# something on fire sets whatever else is in its cell burning, once
+# everyone has moved (see effect_burning)
+proc burning {entv depth} {
+    global ecs
+    upvar $depth $entv ent
+    ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)} pos {
+        eventpost tick $pos(w) $pos(x) $pos(y) $ent(entid) burning
+    }
+    spend 10
+}
+
+# heads for whoever is at the keyboard by way of a flow map shared by
+# every chaser on the level (made again only when the turn has moved
+# on), attacking once next to them
+proc chaser {entv depth} {
+    global ecs turn flow_turn
+    upvar $depth $entv ent
+    ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)} pos {
+        set flow player$pos(w)
+        if {![info exists flow_turn($flow)] || $flow_turn($flow) != $turn} {
+            flowmap $flow $pos(w) [ecs eval {
+                SELECT x,y FROM position INNER JOIN components USING (entid)
+                WHERE comp='keyboard' AND w=$pos(w)
+            }]
+            set flow_turn($flow) $turn
+        }
+        set step [flowstep $flow $pos(w) $pos(x) $pos(y)]
+        if {![llength $step]} {break}
+        lassign $step dx dy dist
+        set newx [+ $pos(x) $dx]
+        set newy [+ $pos(y) $dy]
+        if {$dist == 0} {
+            # a break or continue from this ends the one row loop
+            set dest [celltop $pos(w) $newx $newy]
+            if {[llength $dest]} {
+                lassign $dest destid interact
+                $interact $entv [+ $depth 1] \
+                  $pos(w) $pos(x) $pos(y) $newx $newy 10 $destid
+            }
+        } elseif {![move_blocked $entv [+ $depth 1] $pos(w) $newx $newy]} {
+            move_ent $ent(entid) \
+              $pos(w) $pos(x) $pos(y) $pos(w) $newx $newy 10
+        }
+    }
+    # always costs energy as it tried (and maybe failed) to move
+    spend 10
+}
+
+# interact handler: whatever went into a chute, and is still there,
+# falls to the level below
+proc chute_drop {w x y events occupants} {
+    global ecs
+    foreach {id destid} $events {
+        if {$id ni $occupants || ![ecs exists {
+            SELECT 1 FROM position WHERE w=$w AND x=$x AND y=$y
+              AND entid=$destid AND interact='act_chute'
+        }]} {continue}
+        # TODO but need to see if the move is legal as something may be
+        # blocking the stair
+        catch {move_ent $id $w $x $y [+ $w 1] $x $y 0}
+    }
+}
+
+# bring a level up to the current time a move at a time, as tick would
+# have, for at most limit moves; any time left over is skipped as if the
+# level had been frozen for it
+proc catch_up {lvl limit} {
+    global lod synced
+    if {![info exists synced($lvl)]} {set synced($lvl) 0}
+    set behind [- $lod(now) $synced($lvl)]
+    for {set i 0} {$behind > 0 && $i < $limit} {incr i} {
+        set min [levels_min $lvl $lvl]
+        if {$min eq ""} {break}
+        if {$min > $behind} {set min $behind}
+        tick_levels $lvl $lvl $min
+        eventrun
+        set behind [- $behind $min]
+    }
+    set synced($lvl) $lod(now)
+}
+
 proc cmd_commands {entv depth ch} {
     global ecs
     # TODO instead post message or bring up a reader screen
     ecs eval {SELECT key,desc FROM keymap ORDER BY key} kmap {
-        warn "[format %c $kmap(key)] - $kmap(desc)"
+        log info "[format %c $kmap(key)] - $kmap(desc)"
     }
 }
 
@@ -63,7 +206,7 @@ proc cmd_commands {entv depth ch} {
 proc cmd_movekey {entv depth ch} {
     global boundary ecs
     upvar $depth $entv ent
-    set xy [ecs eval {SELECT dx,dy FROM keymoves WHERE key=$ch}]
+    set xy [keymove $ch]
     ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)} pos {
         set lvl  $pos(w)
         set newx [+ $pos(x) [lindex $xy 0]]
@@ -75,23 +218,42 @@ proc cmd_movekey {entv depth ch} {
         }
 
         if {[move_blocked $entv [+ $depth 1] $lvl $newx $newy]} {
-            ecs eval {
-              SELECT entid,interact FROM position
-              INNER JOIN display USING (entid)
-              WHERE w=$lvl AND x=$newx AND y=$newy ORDER BY zlevel DESC LIMIT 1
-            } dest {
-                tailcall $dest(interact) $entv $depth \
-                  $lvl $pos(x) $pos(y) $newx $newy 10 $dest(entid)
+            set dest [celltop $lvl $newx $newy]
+            if {[llength $dest]} {
+                lassign $dest destid interact
+                tailcall $interact $entv $depth \
+                  $lvl $pos(x) $pos(y) $newx $newy 10 $destid
             }
             warn "blocked but no interaction at $lvl,$newx,$newy"
             return -code continue
         } else {
-            tailcall move_ent $ent(entid) $depth \
+            tailcall move_ent $ent(entid) \
               $lvl $pos(x) $pos(y) $lvl $newx $newy 10
         }
     }
 }
 
+# shift+move - keep moving that way until something interesting happens
+proc cmd_run {entv depth ch} {
+    global run
+    upvar $depth $entv ent
+    run_start $ent(entid) [list dir [keymove [+ $ch 32]]]
+    if {[run_step $entv [+ $depth 1]]} {return -code break}
+    unset run
+    return -code continue
+}
+
+proc cmd_history {entv depth ch} {
+    scrollback
+    return -code continue
+}
+
+proc cmd_timings {entv depth ch} {
+    timing_dump
+    logmsg "timings written to timing.json"
+    return -code continue
+}
+
 proc cmd_position {entv depth ch} {
     global ecs
     upvar $depth $entv ent
@@ -112,7 +274,10 @@ proc cmd_position {entv depth ch} {
 # it's due to a move or command?
 #
 # oh may also need ordering, as "burning cloud" above a hole might
-# burn the entity *before* they get moved to new cell by hole
+# burn the entity *before* they get moved to new cell by hole. the
+# interaction is still made right away, though an interact event is
+# also posted for anything that wants to act on it in order (see
+# events.c)
 proc cmd_stair {entv depth ch} {
     global ecs
     upvar $depth $entv ent
@@ -137,7 +302,7 @@ proc cmd_stair {entv depth ch} {
             }
             # TODO like with chute destination square must be empty of
             # solids...
-            tailcall move_ent $ent(entid) $depth \
+            tailcall move_ent $ent(entid) \
               $pos(w) $pos(x) $pos(y) $nlvl $pos(x) $pos(y) 20
         }
     }
@@ -150,7 +315,7 @@ proc cmd_stair {entv depth ch} {
         }]
         if {$chute == 32} {
             warn "going down"
-            tailcall move_ent $ent(entid) $depth \
+            tailcall move_ent $ent(entid) \
               $pos(w) $pos(x) $pos(y) [+ $pos(w) 1] $pos(x) $pos(y) 10
         }
     }
@@ -158,14 +323,39 @@ proc cmd_stair {entv depth ch} {
 }
 
 proc cmd_pass {entv depth ch} {
-    global ecs
-    upvar $depth $entv ent
-    uplevel $depth {if {$new_energy < 10} {set new_energy 10}}
+    spend 10
     return -code break
 }
 
 proc cmd_quit {entv depth ch} {exit 0}
 
+# walk to the nearest stair over however many turns it takes
+proc cmd_travel {entv depth ch} {
+    global ecs run
+    upvar $depth $entv ent
+    set wxy [ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)}]
+    set lvl [lindex $wxy 0]
+    set best {}
+    ecs eval {
+        SELECT x,y FROM position INNER JOIN display USING (entid)
+        WHERE w=$lvl AND ch IN (60,62)
+    } stair {
+        set steps [path $wxy $stair(x) $stair(y)]
+        if {[llength $steps] &&
+            ($best eq {} || [llength $steps] < [llength $best])} {
+            set best $steps
+        }
+    }
+    if {$best eq {}} {
+        logmsg "no stair to travel to"
+        return -code continue
+    }
+    run_start $ent(entid) [list path $best]
+    if {[run_step $entv [+ $depth 1]]} {return -code break}
+    unset run
+    return -code continue
+}
+
 # a "do nothing" command that consumes no energy
 proc cmd_version {entv depth ch} {
     warn "version 42"
@@ -189,11 +379,28 @@ proc do {varname first last body} {
     }
 }
 
+# tick handler: each burning thing that posted to the cell is a blow at
+# each other thing there, all in one resolve_attacks
+proc effect_burning {w x y events occupants} {
+    set burning {}
+    foreach {id data} $events {
+        if {$data eq "burning"} {lappend burning $id}
+    }
+    foreach id $burning {
+        set attacks {}
+        foreach target $occupants {
+            if {$target != $id} {lappend attacks $id $target}
+        }
+        set hits [resolve_attacks $attacks]
+        if {[llength $hits]} {report_hits $id $hits}
+    }
+}
+
 proc get_direction {} {
     while 1 {
         set ch [getch]
         if {$ch == 27} {return -code return}
-        set xy [ecs eval {SELECT dx,dy FROM keymoves WHERE key=$ch}]
+        set xy [keymove $ch]
         if {[llength $xy] > 0} {break}
     }
     return $xy
@@ -201,77 +408,154 @@ proc get_direction {} {
 
 proc init_map {} {
     global ecs boundary
-    for {set lvl [lindex $boundary 4]} "\$lvl<=[lindex $boundary 5]" {incr lvl} {
+    lassign $boundary - - - - wmin wmax
+    for {set lvl $wmin} {$lvl <= $wmax} {incr lvl} {
         lappend maps [ecs eval {
-            SELECT x,y,ch,max(zlevel) FROM position
-            INNER JOIN display USING (entid)
-            WHERE w=$lvl GROUP BY x,y
+            SELECT DISTINCT x,y FROM position WHERE w=$lvl AND entid IN
+            (SELECT entid FROM components WHERE comp='opaque')
           }] \
           [ecs eval {
             SELECT DISTINCT x,y FROM position WHERE w=$lvl AND entid IN
-            (SELECT entid FROM components WHERE comp='opaque')
+            (SELECT entid FROM components WHERE comp='solid')
           }]
     }
     initmap $boundary {*}$maps
+    cellinit [ecs eval {
+        SELECT w,x,y,entid,ch,zlevel,interact FROM position
+        INNER JOIN display USING (entid)
+    }]
+    ecs eval {
+        SELECT entid,w,x,y,radius FROM light INNER JOIN position USING (entid)
+    } light {
+        lightset $light(entid) $light(w) $light(x) $light(y) $light(radius)
+    }
 }
 
 # get a key and do something with it (for any random entity that
 # needs that)
 proc keyboard {entv depth} {
-    global ecs
+    global run simulating
     upvar $depth $entv ent
-    update_map $entv [+ $depth 1]
+    if {$simulating} {
+        spend 10
+        return
+    }
+    if {[info exists run]} {
+        if {[run_step $entv [+ $depth 1]]} {return}
+        unset run
+    }
+    # keys typed ahead are acted on without drawing the map for each
+    update_map $entv [+ $depth 1] [expr {![keypending]}]
     while 1 {
         while 1 {
             set ch [getch]
-            set cmd [ecs onecolumn {SELECT cmd FROM keymap WHERE key=$ch}]
+            set cmd [keycmd $ch]
             if {$cmd ne ""} {break}
-            warn "$ent(entid) unmapped key $ch"
+            log debug "$ent(entid) unmapped key $ch"
         }
         $cmd $entv [+ $depth 1] $ch
     }
 }
 
+# takes something that was killed off the map; it stays in ents, as
+# not alive. the game is over if it was at the keyboard
+proc kill_ent {id} {
+    global ecs simulating
+    set name [ecs onecolumn {SELECT name FROM ents WHERE entid=$id}]
+    set player [ecs exists {
+        SELECT 1 FROM components WHERE entid=$id AND comp='keyboard'
+    }]
+    set cells [ecs eval {SELECT w,x,y FROM position WHERE entid=$id}]
+    ecs eval {DELETE FROM position WHERE entid=$id}
+    ecs eval {UPDATE ents SET alive=FALSE WHERE entid=$id}
+    foreach {w x y} $cells {
+        celldel $id $w $x $y
+        mapsolid $w $x $y [ecs exists {
+            SELECT 1 FROM components INNER JOIN position USING (entid)
+            WHERE comp='solid' AND w=$w AND x=$x AND y=$y
+        }]
+        mapwall $w $x $y [ecs exists {
+            SELECT 1 FROM components INNER JOIN position USING (entid)
+            WHERE comp='opaque' AND w=$w AND x=$x AND y=$y
+        }]
+    }
+    statdel $id
+    lightdel $id
+    fov_forget $id
+    logmsg "$name dies"
+    if {$player} {
+        log info "$name died on turn $::turn"
+        if {!$simulating} {getch}
+        exit 0
+    }
+}
+
 # Marxist tendencies
 # TODO honoring stairs would be good... maybe instead call over to cmd_movekey?
 proc leftmover {entv depth} {
     global boundary ecs
     upvar $depth $entv ent
     ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)} pos {
-        set newx [expr $pos(x) <= [lindex $boundary 0] \
-                     ? [lindex $boundary 2] \
-                     : $pos(x) - 1]
+        set newx [expr {$pos(x) <= [lindex $boundary 0]
+                        ? [lindex $boundary 2]
+                        : $pos(x) - 1}]
         if {![move_blocked $entv [+ $depth 1] $pos(w) $newx $pos(y)]} {
             ecs eval {UPDATE position SET x=$newx WHERE entid=$ent(entid)}
-            ecs eval {
-                UPDATE position SET dirty=TRUE
-                WHERE (w=$pos(w) AND x=$pos(x) AND y=$pos(y))
-                   OR (w=$pos(w) AND x=$newx AND y=$pos(y))
-            }
+            cellmove $ent(entid) $pos(w) $pos(x) $pos(y) \
+              $pos(w) $newx $pos(y)
+            opaque_moved $ent(entid) $pos(w) $pos(x) $pos(y) \
+              $pos(w) $newx $pos(y)
+            solid_moved $ent(entid) $pos(w) $pos(x) $pos(y) \
+              $pos(w) $newx $pos(y)
         }
     }
     # always costs energy as it tried (and maybe failed) to move
-    uplevel $depth {if {$new_energy < 10} {set new_energy 10}}
+    spend 10
+}
+
+# when the next energy entity on levels first to last moves, or an
+# empty string if there are none
+proc levels_min {first last} {
+    global ecs
+    ecs onecolumn {
+        SELECT min(energy) FROM components
+        INNER JOIN ents USING (entid) INNER JOIN position USING (entid)
+        WHERE comp='energy' AND w BETWEEN $first AND $last
+    }
 }
 
 proc load_db {{file game.db}} {global ecs; ecs restore $file}
 
+# the key tables do not change during play so are looked up on the C
+# side (see keys.c)
+proc load_keys {} {
+    global ecs
+    keyload [ecs eval {SELECT key,cmd FROM keymap}] \
+      [ecs eval {SELECT key,dx,dy FROM keymoves}]
+}
+
 proc load_or_make_db {file} {
     if {[string length $file]} {
-        warn "load from $file"
+        log info "load from $file"
         load_db $file
-        ecs eval {UPDATE position SET dirty=TRUE}
+        statload [ecs eval {SELECT entid,hp,attack,defense FROM stats}]
         ecs cache size 100
+        startup_phase load_db
     } else {
         global zlevel
         make_db
         ecs cache size 100
+        startup_phase make_db
 
-        make_entity Ekileugor 0 0 1 @ $zlevel(ekileugor) act_fight \
-          energy keyboard
+        # hp attack defense
+        set player [make_entity Ekileugor 0 0 1 @ $zlevel(ekileugor) \
+          act_fight energy keyboard]
+        statset $player 20 4 1
+        set_light $player 3
 
-        make_entity "la nanmu poi terpa lo ke'a xirma" 0 1 1 H \
-          $zlevel(monst) act_fight energy leftmover solid
+        set mover [make_entity "la nanmu poi terpa lo ke'a xirma" 0 1 1 H \
+          $zlevel(monst) act_fight energy leftmover solid]
+        statset $mover 8 2 0
 
         set wall [make_massent bitmu # $zlevel(feature) solid opaque]
 
@@ -294,6 +578,8 @@ proc load_or_make_db {file} {
         set_position $column 0 8 5 act_nope
         set_position $column 0 6 7 act_nope
         set_position $column 0 8 7 act_nope
+        set_light [make_entity "a brazier" 0 7 6 * $zlevel(feature) \
+          act_nope solid] 5
 
         # probably need highlight (and prompt) like in Brogue
         set chuted [make_massent {chute down} { } $zlevel(feature) solid]
@@ -306,8 +592,10 @@ proc load_or_make_db {file} {
         set_position $ustair 1 8 8 act_okay
 
         # merely something solid to be in the stair or chute destination
-        make_entity {walrus} 1 7 3 W $zlevel(monst) act_fight opaque solid
-        make_entity {walrus} 1 2 3 W $zlevel(monst) act_fight opaque solid
+        foreach x {7 2} {
+            statset [make_entity {walrus} 1 $x 3 W $zlevel(monst) \
+              act_fight opaque solid] 12 3 1
+        }
 
         # no interaction and non-solid to prevent interaction (without
         # various items or other conditions). probably needs a status
@@ -323,104 +611,140 @@ proc load_or_make_db {file} {
                 }
             }
         }
+        startup_phase populate
     }
     set_boundaries
+    load_keys
     init_map
+    startup_phase init_map
 }
 
-# this here is the database schema
+# this here is the database schema, created in a single exec
 proc make_db {} {
     global ecs
     ecs cache size 0
     ecs transaction {
-        ecs eval {PRAGMA foreign_keys = ON}
-        # entity - a name for easy ID plus some metadata
         ecs eval {
+            PRAGMA foreign_keys = ON;
+
+            -- entity - a name for easy ID plus some metadata
             CREATE TABLE ents (
               entid INTEGER PRIMARY KEY NOT NULL,
               name TEXT,
               energy INTEGER DEFAULT 10,
               alive BOOLEAN DEFAULT TRUE
-            )
-        }
-        # what an entity that can be displayed looks like
-        ecs eval {
+            );
+
+            -- what an entity that can be displayed looks like; one
+            -- each, so keyed on the entity
             CREATE TABLE display (
-              entid INTEGER NOT NULL,
+              entid INTEGER PRIMARY KEY NOT NULL,
               ch INTEGER,
               zlevel INTEGER,
               FOREIGN KEY(entid) REFERENCES ents(entid)
                     ON UPDATE CASCADE ON DELETE CASCADE
-            )
-        }
-        # where the entity is on the level map (and what happens when it
-        # is interacted with)
-        ecs eval {
+            );
+
+            -- where the entity is on the level map (and what happens
+            -- when it is interacted with). the key clusters the rows
+            -- by cell, as most lookups are of what is in a cell; the
+            -- index on entid covers w,x,y as they are in the key
             CREATE TABLE position (
               entid INTEGER NOT NULL,
-              w INTEGER,
-              x INTEGER,
-              y INTEGER,
+              w INTEGER NOT NULL,
+              x INTEGER NOT NULL,
+              y INTEGER NOT NULL,
               interact TEXT,
-              dirty BOOLEAN DEFAULT TRUE,
+              PRIMARY KEY (w,x,y,entid),
               FOREIGN KEY(entid) REFERENCES ents(entid)
                     ON UPDATE CASCADE ON DELETE CASCADE
-            )
-        }
-        ecs eval {CREATE INDEX position2dirty ON position(dirty)}
-        ecs eval {CREATE INDEX position2xy ON position(w,x,y)}
-        # components an entity has
-        ecs eval {
+            ) WITHOUT ROWID;
+            CREATE INDEX position2entid ON position(entid);
+
+            -- components an entity has. the index on comp also holds
+            -- entid, being in the key
             CREATE TABLE components (
               entid INTEGER NOT NULL,
               comp TEXT NOT NULL,
+              PRIMARY KEY (entid,comp),
               FOREIGN KEY(entid) REFERENCES ents(entid)
                     ON UPDATE CASCADE ON DELETE CASCADE
-            )
-        }
-        ecs eval {CREATE INDEX components2comp ON components(comp)}
-        # ascii(7) decimal values (and maybe some numbers invented by
-        # ncurses) plus a proc to call for the given key
-        ecs eval {
+            ) WITHOUT ROWID;
+            CREATE INDEX components2comp ON components(comp);
+
+            -- hit points and such of what can fight. these are kept in
+            -- C (see stats.c) and only written here at save points
+            CREATE TABLE stats (
+              entid INTEGER PRIMARY KEY NOT NULL,
+              hp INTEGER NOT NULL,
+              attack INTEGER NOT NULL,
+              defense INTEGER NOT NULL,
+              FOREIGN KEY(entid) REFERENCES ents(entid)
+                    ON UPDATE CASCADE ON DELETE CASCADE
+            );
+
+            -- light sources, by radius; the light map is kept in C
+            -- (see light.c) from these and where they are
+            CREATE TABLE light (
+              entid INTEGER PRIMARY KEY NOT NULL,
+              radius INTEGER NOT NULL,
+              FOREIGN KEY(entid) REFERENCES ents(entid)
+                    ON UPDATE CASCADE ON DELETE CASCADE
+            );
+
+            -- ascii(7) decimal values (and maybe some numbers invented
+            -- by ncurses) plus a proc to call for the given key
             CREATE TABLE keymap (
               key INTEGER NOT NULL,
               cmd TEXT NOT NULL,
               desc TEXT
-            )
-        }
-        ecs eval {INSERT INTO keymap VALUES(46,'cmd_pass','skip a turn')}
-        ecs eval {INSERT INTO keymap VALUES(60,'cmd_stair','ascend stair')}
-        ecs eval {INSERT INTO keymap VALUES(62,'cmd_stair','descend stair')}
-        ecs eval {INSERT INTO keymap VALUES(63,'cmd_commands','show commands')}
-        ecs eval {INSERT INTO keymap VALUES(64,'cmd_position','show position')}
-        ecs eval {INSERT INTO keymap VALUES(104,'cmd_movekey','move west')}
-        ecs eval {INSERT INTO keymap VALUES(106,'cmd_movekey','move south')}
-        ecs eval {INSERT INTO keymap VALUES(107,'cmd_movekey','move north')}
-        ecs eval {INSERT INTO keymap VALUES(108,'cmd_movekey','move east')}
-        ecs eval {INSERT INTO keymap VALUES(121,'cmd_movekey','move north-west')}
-        ecs eval {INSERT INTO keymap VALUES(117,'cmd_movekey','move north-east')}
-        ecs eval {INSERT INTO keymap VALUES(98,'cmd_movekey','move south-west')}
-        ecs eval {INSERT INTO keymap VALUES(110,'cmd_movekey','move south-east')}
-        ecs eval {INSERT INTO keymap VALUES(118,'cmd_version','show version')}
-        ecs eval {INSERT INTO keymap VALUES(113,'cmd_quit','quit the game')}
-        #ecs eval {INSERT INTO keymap VALUES(410,'sig_winch','SIGWINCH')}
-        # key to x,y offsets for said key
-        ecs eval {
+            );
+            INSERT INTO keymap VALUES
+              (46,'cmd_pass','skip a turn'),
+              (60,'cmd_stair','ascend stair'),
+              (62,'cmd_stair','descend stair'),
+              (63,'cmd_commands','show commands'),
+              (64,'cmd_position','show position'),
+              (104,'cmd_movekey','move west'),
+              (106,'cmd_movekey','move south'),
+              (107,'cmd_movekey','move north'),
+              (108,'cmd_movekey','move east'),
+              (121,'cmd_movekey','move north-west'),
+              (117,'cmd_movekey','move north-east'),
+              (98,'cmd_movekey','move south-west'),
+              (110,'cmd_movekey','move south-east'),
+              (72,'cmd_run','run west'),
+              (74,'cmd_run','run south'),
+              (75,'cmd_run','run north'),
+              (76,'cmd_run','run east'),
+              (89,'cmd_run','run north-west'),
+              (85,'cmd_run','run north-east'),
+              (66,'cmd_run','run south-west'),
+              (78,'cmd_run','run south-east'),
+              (95,'cmd_travel','travel to the nearest stair'),
+              (118,'cmd_version','show version'),
+              (113,'cmd_quit','quit the game'),
+              (84,'cmd_timings','dump timings'),
+              (80,'cmd_history','message history');
+              -- (410,'sig_winch','SIGWINCH')
+
+            -- key to x,y offsets for said key
             CREATE TABLE keymoves (
                 key INTEGER PRIMARY KEY NOT NULL,
                 dx INTEGER NOT NULL,
                 dy INTEGER NOT NULL,
                 desc TEXT
-            )
+            );
+            INSERT INTO keymoves VALUES
+              (104,-1,0,'move west'),
+              (106,0,1,'move south'),
+              (107,0,-1,'move north'),
+              (108,1,0,'move east'),
+              (121,-1,-1,'move north-west'),
+              (117,1,-1,'move north-east'),
+              (98,-1,1,'move south-west'),
+              (110,1,1,'move south-east');
         }
-        ecs eval {INSERT INTO keymoves VALUES(104,-1,0,"move west")}
-        ecs eval {INSERT INTO keymoves VALUES(106,0,1,"move south")}
-        ecs eval {INSERT INTO keymoves VALUES(107,0,-1,"move north")}
-        ecs eval {INSERT INTO keymoves VALUES(108,1,0,"move east")}
-        ecs eval {INSERT INTO keymoves VALUES(121,-1,-1,"move north-west")}
-        ecs eval {INSERT INTO keymoves VALUES(117,1,-1,"move north-east")}
-        ecs eval {INSERT INTO keymoves VALUES(98,-1,1,"move south-west")}
-        ecs eval {INSERT INTO keymoves VALUES(110,1,1,"move south-east")}
     }
 }
 # oh can probably detect shift+move or control+move and pass shift/control
@@ -433,8 +757,9 @@ proc make_entity {name lvl x y ch zlevel interact args} {
     ecs transaction {
         ecs eval {INSERT INTO ents(name) VALUES($name)}
         set entid [ecs last_insert_rowid]
-        set_position $entid $lvl $x $y $interact
+        # display first, for set_position to put it in the cell stack
         set_display $entid $ch $zlevel
+        set_position $entid $lvl $x $y $interact
         foreach comp $args {set_component $entid $comp}
     }
     return $entid
@@ -467,19 +792,182 @@ proc move_blocked {entv depth lvl newx newy} {
     return [expr {$this + $that > 1}]
 }
 
-proc move_ent {id depth oldw oldx oldy neww newx newy cost} {
-    global ecs
+# a level is brought up to the current time before anything arrives
+# on it, so the catch up does not take time off of the arrival again
+proc move_ent {id oldw oldx oldy neww newx newy cost} {
+    global ecs lod
+    if {$neww != $oldw} {catch_up $neww $lod(catchup)}
     ecs eval {UPDATE position SET w=$neww,x=$newx,y=$newy WHERE entid=$id}
-    ecs eval {
-        UPDATE position SET dirty=TRUE
-        WHERE (w=$oldw AND x=$oldx AND y=$oldy)
-           OR (w=$neww AND x=$newx AND y=$newy)
-    }
-    uplevel $depth "if {\$new_energy < $cost} {set new_energy $cost}"
+    cellmove $id $oldw $oldx $oldy $neww $newx $newy
+    opaque_moved $id $oldw $oldx $oldy $neww $newx $newy
+    solid_moved $id $oldw $oldx $oldy $neww $newx $newy
+    spend $cost
     return -code break
 }
 
-proc save_db {{file game.db}} {global ecs; ecs backup $file}
+# keep the C side wall map (and with it the cached FOVs) current when
+# something that blocks sight moves
+proc opaque_moved {id oldw oldx oldy neww newx newy} {
+    global ecs
+    if {![ecs exists {
+        SELECT 1 FROM components WHERE entid=$id AND comp='opaque'
+    }]} {return}
+    mapwall $oldw $oldx $oldy [ecs exists {
+        SELECT 1 FROM components INNER JOIN position USING (entid)
+        WHERE comp='opaque' AND w=$oldw AND x=$oldx AND y=$oldy
+    }]
+    mapwall $neww $newx $newy 1
+}
+
+# messages for the {target damage hp ...} of resolve_attacks, and the
+# end of any it killed; an area effect is one message for the lot
+proc report_hits {id hits} {
+    global ecs
+    set name [ecs onecolumn {SELECT name FROM ents WHERE entid=$id}]
+    if {[llength $hits] == 3} {
+        lassign $hits target damage
+        set them [ecs onecolumn {SELECT name FROM ents WHERE entid=$target}]
+        logmsg "$name hits $them for $damage"
+    } else {
+        logmsg "$name hits [expr {[llength $hits] / 3}] things"
+    }
+    foreach {target damage hp} $hits {
+        if {$hp <= 0} {kill_ent $target}
+    }
+}
+
+# run (or travel) state for the keyboard entity: dir dx dy or path
+# {x y ...}, plus what is used to tell whether to stop
+proc run_start {id moves} {
+    global ecs run
+    set wxy [ecs eval {SELECT w,x,y FROM position WHERE entid=$id}]
+    set run [dict create {*}$moves \
+      logged [logcount] movers [visible_movers $id $wxy]]
+}
+
+# one step of a run, or 0 if it is over: something was logged, a mover
+# came into or went out of view, or the way is blocked. the map is not
+# drawn until the run stops
+proc run_step {entv depth} {
+    global boundary ecs run
+    upvar $depth $entv ent
+    update_map $entv [+ $depth 1] 0
+    set wxy [ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)}]
+    if {[logcount] != [dict get $run logged] ||
+        [visible_movers $ent(entid) $wxy] ne [dict get $run movers]} {
+        return 0
+    }
+    lassign $wxy lvl x y
+    if {[dict exists $run dir]} {
+        lassign [dict get $run dir] dx dy
+        set newx [+ $x $dx]
+        set newy [+ $y $dy]
+        set last 0
+    } else {
+        set steps [dict get $run path]
+        if {![llength $steps]} {return 0}
+        lassign $steps newx newy
+        dict set run path [lrange $steps 2 end]
+        set last [expr {[llength $steps] == 2}]
+    }
+    if {![<= [lindex $boundary 0] $newx [lindex $boundary 2]] ||
+        ![<= [lindex $boundary 1] $newy [lindex $boundary 3]]} {
+        return 0
+    }
+    # runs stop short of walls, doors, and the like; travel may end on one
+    if {!$last && [ecs exists {
+        SELECT 1 FROM components INNER JOIN position USING (entid)
+        WHERE comp='solid' AND w=$lvl AND x=$newx AND y=$newy
+    }]} {return 0}
+    if {[move_blocked $entv [+ $depth 1] $lvl $newx $newy]} {return 0}
+    catch {move_ent $ent(entid) $lvl $x $y $lvl $newx $newy 10}
+    return 1
+}
+
+# the rename leaves any old file intact should the backup not finish
+proc save_db {{file game.db}} {
+    global ecs
+    stat_sync
+    ecs backup $file.tmp
+    file rename -force $file.tmp $file
+}
+
+# checksum of the ECS state, for comparing replays of a recorded game
+proc state_hash {} {
+    global ecs
+    format %08x [zlib crc32 [list \
+      [ecs eval {SELECT * FROM ents ORDER BY entid}] \
+      [ecs eval {SELECT * FROM position ORDER BY entid,w,x,y}] \
+      [ecs eval {SELECT * FROM components ORDER BY entid,comp}] \
+      [ecs eval {SELECT * FROM light ORDER BY entid}] \
+      [statdump]]]
+}
+
+# advance up to ticks turns, or until the until expression (evaluated
+# at global level after each turn) is true, with nothing drawn and any
+# keyboard entity passing. commits once every batch turns instead of
+# once per entity per turn. returns a dict of the ticks done, seconds
+# taken, and ticks per second
+proc simulate {ticks {until 0} {batch 100}} {
+    global ecs simulating turn
+    set simulating 1
+    set start [clock microseconds]
+    set done 0
+    try {
+        while {$done < $ticks} {
+            ecs transaction {
+                for {set i 0} {$i < $batch && $done < $ticks} {incr i} {
+                    incr turn
+                    tick
+                    incr done
+                    if {[uplevel #0 [list expr $until]]} {set ticks $done}
+                }
+            }
+        }
+    } finally {
+        set simulating 0
+    }
+    set secs [expr {([clock microseconds] - $start) / 1e6}]
+    set rate [expr {$secs > 0 ? $done / $secs : 0}]
+    log info [format "simulated %d ticks in %.6f s %.1f ticks/s" \
+      $done $secs $rate]
+    dict create ticks $done secs $secs rate $rate
+}
+
+# likewise for the C side solid map, for pathfinding
+proc solid_moved {id oldw oldx oldy neww newx newy} {
+    global ecs
+    if {![ecs exists {
+        SELECT 1 FROM components WHERE entid=$id AND comp='solid'
+    }]} {return}
+    mapsolid $oldw $oldx $oldy [ecs exists {
+        SELECT 1 FROM components INNER JOIN position USING (entid)
+        WHERE comp='solid' AND w=$oldw AND x=$oldx AND y=$oldy
+    }]
+    mapsolid $neww $newx $newy 1
+}
+
+# record the energy cost of what the current entity did; the highest
+# cost spent during the turn becomes their new energy value
+proc spend {cost} {
+    global spent
+    if {$spent < $cost} {set spent $cost}
+}
+
+# bring the stats table up to date with the C side, for a save
+proc stat_sync {} {
+    global ecs
+    lassign [statsync] changed gone
+    ecs transaction {
+        foreach id $gone {ecs eval {DELETE FROM stats WHERE entid=$id}}
+        foreach {id hp attack defense} $changed {
+            ecs eval {
+                INSERT OR REPLACE INTO stats
+                VALUES($id,$hp,$attack,$defense)
+            }
+        }
+    }
+}
 
 proc set_boundaries {} {
     global boundary ecs
@@ -499,11 +987,25 @@ proc set_display {ent ch zlevel} {
     ecs eval {INSERT INTO display VALUES($ent,$ch,$zlevel)}
 }
 
+# a light source has a radius of at most MAX_FOV_RADIUS and is in one
+# place at a time; it lights from where it is, and follows it about
+proc set_light {ent radius} {
+    global ecs
+    ecs eval {INSERT OR REPLACE INTO light VALUES($ent,$radius)}
+    ecs eval {SELECT w,x,y FROM position WHERE entid=$ent} pos {
+        lightset $ent $pos(w) $pos(x) $pos(y) $radius
+    }
+}
+
 proc set_position {ent lvl x y act} {
     global ecs
     ecs eval {
         INSERT INTO position(entid,w,x,y,interact) VALUES($ent,$lvl,$x,$y,$act)
     }
+    # init_map does this for everything placed before it
+    ecs eval {SELECT ch,zlevel FROM display WHERE entid=$ent} disp {
+        cellput $lvl $x $y $ent $disp(ch) $disp(zlevel) $act
+    }
 }
 
 proc unset_component {ent cname} {
@@ -526,70 +1028,155 @@ proc update_ent {entv depth} {
         # (and maybe also display) but there's no actual constraint
         # enforcing that in the database
         switch $comp(comp) {
+            burning -
+            chaser -
             keyboard -
             leftmover {$comp(comp) $entv [+ $depth 1]}
         }
     }
 }
 
-proc update_map {entv depth} {
-    global ecs
+# draw? is false while running, when only what is seen is noted
+proc update_map {entv depth {draw 1}} {
+    global ecs sight
     upvar $depth $entv ent
     set wxy [ecs eval {SELECT w,x,y FROM position WHERE entid=$ent(entid)}]
-    set lvl [lindex $wxy 0]
-    ecs transaction {
-        set dirty [ecs eval {
-            SELECT entid,x,y,ch,max(zlevel)
-            FROM position INNER JOIN display USING (entid)
-            WHERE dirty=TRUE AND w=$lvl GROUP BY x,y
-        }]
-        set len [llength $dirty]
-        for {set i 0} {$i < $len} {incr i 5} {
-            set x [lindex $dirty [+ $i 1]]
-            set y [lindex $dirty [+ $i 2]]
-            # max(zlevel) unused so insert the is-opaque boolean there
-            lset dirty [+ $i 4] [ecs eval {
-                SELECT COUNT(*) FROM components
-                WHERE comp='opaque' AND entid
-                IN (SELECT entid FROM position WHERE w=$lvl AND x=$x AND y=$y)
-            }]
+    refreshmap $ent(entid) $wxy $sight $draw
+}
+
+# one turn of a simple integer-based energy system: entity with the
+# lowest value moves, and that value is whacked off of the energy value
+# of every other entity. depending on their action, a new energy value
+# is assigned. no ordering is attempted when two things move at the
+# same time
+#
+# only the level the keyboard entity is on gets a turn (or every level,
+# if there is no such entity); see lod for the others
+proc tick {} {
+    global boundary lod synced turn
+    set lvl [active_level]
+    if {$lvl < 0} {
+        lassign $boundary - - - - first last
+    } else {
+        if {$lvl != $lod(active)} {
+            catch_up $lvl $lod(catchup)
+            set lod(active) $lvl
         }
-        #                     FOV radius
-        refreshmap $wxy $dirty 3
-        ecs eval {UPDATE position SET dirty=FALSE WHERE dirty=TRUE AND w=$lvl}
+        set first $lvl
+        set last $lvl
+    }
+    set min [levels_min $first $last]
+    if {$min eq ""} {return}
+    # the levels ticked are at the new time as they move, for anything
+    # that goes to another level to be caught up to
+    incr lod(now) $min
+    for {set w $first} {$w <= $last} {incr w} {set synced($w) $lod(now)}
+    tick_levels $first $last $min
+    eventrun
+    if {$lvl >= 0 && $turn % $lod(nearby) == 0} {
+        lassign $boundary - - - - wmin wmax
+        if {$lvl > $wmin} {catch_up [- $lvl 1] $lod(catchup)}
+        if {$lvl < $wmax} {catch_up [+ $lvl 1] $lod(catchup)}
     }
 }
 
-# the main game loop - a simple integer-based energy system: entity with
-# the lowest value moves, and that value is whacked off of the energy
-# value of every other entity. depending on their action, a new energy
-# value is assigned. no ordering is attempted when two things move at
-# the same time
-proc use_energy {} {
-    global ecs
-    set min [ecs eval {SELECT min(energy) FROM ents}]
-    ecs eval {
-        SELECT * FROM components INNER JOIN ents USING (entid)
-        WHERE comp='energy'
-    } ent {
+# step energy entities on levels first to last on by that much time,
+# and let those whose energy that uses up act
+proc tick_levels {first last step} {
+    global ecs spent
+    # read out before any of them move, so that someone who moves
+    # further along the position index is not come across again
+    foreach {id energy} [ecs eval {
+        SELECT entid,energy FROM components
+        INNER JOIN ents USING (entid) INNER JOIN position USING (entid)
+        WHERE comp='energy' AND w BETWEEN $first AND $last
+    }] {
+        array set ent [list entid $id energy $energy]
+        # NOTE includes the wait on getch for keyboard entities
+        set start [timing_now]
         ecs transaction {
-            set new_energy [- $ent(energy) $min]
+            set new_energy [- $ent(energy) $step]
             if {$new_energy <= 0} {
+                set spent 0
                 update_ent ent 1
-                # TODO probably here apply any in-cell status effects
+                if {$new_energy < $spent} {set new_energy $spent}
+                # in-cell status effects post tick events instead,
+                # which tick runs once everyone has moved
             }
             if {$new_energy <= 0} {error "energy must be positive integer"}
             ecs eval {
                 UPDATE ents SET energy=$new_energy WHERE entid=$ent(entid)
             }
         }
+        timing_add use_energy $start
     }
+}
+
+# the main game loop
+proc use_energy {} {
+    global autosave turn
+    incr turn
+    if {$autosave && $turn % $autosave == 0} {autosave_db}
+    tick
     tailcall use_energy
 }
 
-proc warn {msg} {puts stderr $msg}
+# sorted IDs of the other movers in view of w,x,y, within the FOV
+# radius of update_map, and lit
+proc visible_movers {id wxy} {
+    global ecs sight
+    lassign $wxy lvl x y
+    set reach [- $sight 1]
+    set near [ecs eval {
+        SELECT entid,x,y FROM position INNER JOIN components USING (entid)
+        WHERE comp='energy' AND entid!=$id AND w=$lvl
+          AND x BETWEEN $x-$reach AND $x+$reach
+          AND y BETWEEN $y-$reach AND $y+$reach
+    }]
+    set xys {}
+    foreach {- tx ty} $near {lappend xys $tx $ty}
+    set movers {}
+    foreach {mid - -} $near seen [lineofsight $wxy $xys] \
+      lit [lightlevel $lvl $xys] {
+        if {$seen && $lit} {lappend movers $mid}
+    }
+    lsort -integer $movers
+}
+
+# byte-compile every proc now instead of on first call. disassemble
+# is what compiles a proc without running it, but is unsupported, so
+# without it the procs are left to compile on first call as usual
+proc warm_procs {} {
+    if {![llength [info commands ::tcl::unsupported::disassemble]]} {
+        log info "warm_procs: no disassemble, procs compile on first call"
+        return
+    }
+    foreach name [info procs] {::tcl::unsupported::disassemble proc $name}
+}
+
+proc warn {msg} {log warn $msg}
+
+startup_phase init.tcl
+
+if {$warmup} {
+    warm_procs
+    startup_phase warm_procs
+}
+
+# higher priorities go first, so what is in a burning cell burns before
+# a chute there drops it
+eventon tick 10 effect_burning
+eventon interact 0 chute_drop
 
 load_or_make_db $dbfile
 
-# offline copy so I can poke around with `sqlite3 game.db`
-if {![string length $dbfile]} {save_db}
+# offline copy so I can poke around with `sqlite3 game.db`, written in
+# the background when autosave is on
+if {$savedb && ![string length $dbfile]} {
+    if {$autosave} {
+        autosave_db
+    } else {
+        save_db
+    }
+    startup_phase save_db
+}
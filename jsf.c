@@ -45,7 +45,7 @@ uint32_t ranval(void) {
     return ctx.d;
 }
 
-void setup_jsf(void) {
+uint32_t setup_jsf(void) {
 #ifdef USE_RDRND
     int ret = _rdrand32_step(&seed);
     if (ret != 1) abort();
@@ -56,4 +56,5 @@ void setup_jsf(void) {
     close(fd);
 #endif
     raninit(seed);
+    return seed;
 }
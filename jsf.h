@@ -5,6 +5,7 @@
 #define DEV_RANDOM "/dev/urandom"
 #endif
 
+void raninit(uint32_t seed);
 uint32_t ranval(void);
 
 #endif
@@ -0,0 +1,136 @@
+/* key dispatch - the keymap and keymoves tables do not change during
+ * play, so they are loaded once into a table indexed by key and each
+ * keypress is looked up here instead of with SQL. also whether keys are
+ * queued up, so the map need not be drawn for each of them */
+
+#include "prentice.h"
+
+// ascii plus the ncurses KEY_* values that matter
+#define MAX_KEYS 512
+
+// the results of keycmd and keymove, made once; NULL if not mapped
+struct key {
+    Tcl_Obj *cmd;
+    Tcl_Obj *move; // dx dy
+};
+
+struct keys {
+    struct key key[MAX_KEYS];
+};
+
+static void keys_clear(struct keys *keys);
+static int pr_keycmd(ClientData clientData, Tcl_Interp *interp, int objc,
+                     Tcl_Obj *CONST objv[]);
+static int pr_keyload(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_keymove(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_keypending(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]);
+
+static void keys_clear(struct keys *keys) {
+    for (int i = 0; i < MAX_KEYS; i++) {
+        if (keys->key[i].cmd) Tcl_DecrRefCount(keys->key[i].cmd);
+        if (keys->key[i].move) Tcl_DecrRefCount(keys->key[i].move);
+        keys->key[i].cmd  = NULL;
+        keys->key[i].move = NULL;
+    }
+}
+
+void keys_commands(struct game *game) {
+    if ((game->keys = calloc(1, sizeof(struct keys))) == NULL) oom();
+    LINK_COMMAND(game, "keycmd", pr_keycmd);
+    LINK_COMMAND(game, "keyload", pr_keyload);
+    LINK_COMMAND(game, "keymove", pr_keymove);
+    LINK_COMMAND(game, "keypending", pr_keypending);
+}
+
+void keys_free(struct game *game) {
+    keys_clear(game->keys);
+    free(game->keys);
+}
+
+// key - the command proc for the key, or an empty string
+static int pr_keycmd(ClientData clientData, Tcl_Interp *interp, int objc,
+                     Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int ch;
+    assert(objc == 2);
+    if (Tcl_GetIntFromObj(interp, objv[1], &ch) != TCL_OK) return TCL_ERROR;
+    if (ch >= 0 && ch < MAX_KEYS && game->keys->key[ch].cmd)
+        Tcl_SetObjResult(interp, game->keys->key[ch].cmd);
+    return TCL_OK;
+}
+
+// {key cmd ...} {key dx dy ...} - as from the keymap and keymoves
+// tables; replaces whatever was loaded before
+static int pr_keyload(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, ch, dx, dy;
+    Tcl_Obj **list;
+    assert(objc == 3);
+    keys_clear(game->keys);
+
+    Tcl_ListObjGetElements(interp, objv[1], &count, &list);
+    assert((count & 1) == 0);
+    for (int i = 0; i < count; i += 2) {
+        Tcl_GetIntFromObj(interp, list[i], &ch);
+        if (ch < 0 || ch >= MAX_KEYS) {
+            log_msg(LOG_WARN, "keymap key %d out of range", ch);
+            continue;
+        }
+        struct key *key = &game->keys->key[ch];
+        if (key->cmd) Tcl_DecrRefCount(key->cmd);
+        key->cmd = list[i + 1];
+        Tcl_IncrRefCount(key->cmd);
+    }
+
+    Tcl_ListObjGetElements(interp, objv[2], &count, &list);
+    assert(count % 3 == 0);
+    for (int i = 0; i < count; i += 3) {
+        Tcl_GetIntFromObj(interp, list[i], &ch);
+        if (ch < 0 || ch >= MAX_KEYS) {
+            log_msg(LOG_WARN, "keymoves key %d out of range", ch);
+            continue;
+        }
+        struct key *key = &game->keys->key[ch];
+        Tcl_GetIntFromObj(interp, list[i + 1], &dx);
+        Tcl_GetIntFromObj(interp, list[i + 2], &dy);
+        Tcl_Obj *xy[2] = {Tcl_NewIntObj(dx), Tcl_NewIntObj(dy)};
+        if (key->move) Tcl_DecrRefCount(key->move);
+        key->move = Tcl_NewListObj(2, xy);
+        Tcl_IncrRefCount(key->move);
+    }
+    return TCL_OK;
+}
+
+// key - the dx dy the key moves by, or an empty list
+static int pr_keymove(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int ch;
+    assert(objc == 2);
+    if (Tcl_GetIntFromObj(interp, objv[1], &ch) != TCL_OK) return TCL_ERROR;
+    if (ch >= 0 && ch < MAX_KEYS && game->keys->key[ch].move)
+        Tcl_SetObjResult(interp, game->keys->key[ch].move);
+    return TCL_OK;
+}
+
+// whether a key has already been typed and is waiting to be read. a
+// replay always has the next key but draws each turn anyway, for any
+// spectators
+static int pr_keypending(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int ch = ERR;
+    if (!game->hosted && !replaying()) {
+        // nothing has been drawn since the last doupdate, so the getch
+        // does not refresh anything
+        timeout(0);
+        if ((ch = getch()) != ERR) ungetch(ch);
+        timeout(-1);
+    }
+    Tcl_SetObjResult(interp, Tcl_NewBooleanObj(ch != ERR));
+    return TCL_OK;
+}
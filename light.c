@@ -0,0 +1,204 @@
+/* lighting - each light source lights what it can see within its radius
+ * (by way of digital_fov, as for the FOV of an entity), brightest at
+ * the source and one less each cell out. what every light on a level
+ * gives to a cell is summed in map_light, which refreshmap takes as
+ * what can be seen of the FOV. a light is only worked out again when
+ * it moves or the wall map changes at a cell it lights, and then its
+ * old light is taken off of map_light and the new added, so a turn
+ * costs only the lights that changed */
+
+#include "digital-fov.h"
+#include "prentice.h"
+
+struct light {
+    int lvl, x, y, radius;
+    int **grid; // (2 * MAX_FOV_RADIUS + 1) squared, as for digital_fov
+};
+
+static void light_add(struct game *game, struct light *light, int sign);
+static void light_delete(struct light *light);
+static struct light *light_new(void);
+static void light_place(struct game *game, struct light *light, int lvl,
+                        int x, int y, int radius);
+static int pr_lightdel(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_lightlevel(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]);
+static int pr_lightset(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+
+// Chebyshev, as for the distance in map.c
+inline static int distance(int ax, int ay, int bx, int by) {
+    int dx = abs(bx - ax);
+    int dy = abs(by - ay);
+    return dx > dy ? dx : dy;
+}
+
+// puts the light on (sign 1) or takes it off (sign -1) the light map
+static void light_add(struct game *game, struct light *light, int sign) {
+    int **map = game->map_light[light->lvl];
+    for (int i = 0; i <= 2 * light->radius; i++) {
+        int mapx = light->x - light->radius + i;
+        if (mapx < 0 || mapx >= game->map_size_x) continue;
+        for (int j = 0; j <= 2 * light->radius; j++) {
+            int mapy = light->y - light->radius + j;
+            if (mapy < 0 || mapy >= game->map_size_y) continue;
+            int dist = distance(light->x, light->y, mapx, mapy);
+            if (dist < light->radius && light->grid[i][j])
+                map[mapx][mapy] += sign * (light->radius - dist);
+        }
+    }
+}
+
+void light_commands(struct game *game) {
+    // entid to struct light
+    Tcl_InitHashTable(&game->lights, TCL_ONE_WORD_KEYS);
+    LINK_COMMAND(game, "lightdel", pr_lightdel);
+    LINK_COMMAND(game, "lightlevel", pr_lightlevel);
+    LINK_COMMAND(game, "lightset", pr_lightset);
+}
+
+static void light_delete(struct light *light) {
+    free(light->grid[0]);
+    free(light->grid);
+    free(light);
+}
+
+void light_free(struct game *game) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&game->lights, &search);
+    for (; entry != NULL; entry = Tcl_NextHashEntry(&search))
+        light_delete(Tcl_GetHashValue(entry));
+    Tcl_DeleteHashTable(&game->lights);
+}
+
+// from cellmove, for anything displayed; most things moving are not
+// lights
+void light_moved(struct game *game, Tcl_WideInt entid, int neww, int newx,
+                 int newy) {
+    Tcl_HashEntry *entry =
+        Tcl_FindHashEntry(&game->lights, (char *) (intptr_t) entid);
+    if (entry == NULL) return;
+    struct light *light = Tcl_GetHashValue(entry);
+    light_add(game, light, -1);
+    light_place(game, light, neww, newx, newy, light->radius);
+}
+
+static struct light *light_new(void) {
+    struct light *light;
+    int size = 2 * MAX_FOV_RADIUS + 1;
+    if ((light = calloc(1, sizeof(struct light))) == NULL) oom();
+    if ((light->grid = malloc(sizeof(int *) * size)) == NULL) oom();
+    if ((light->grid[0] = calloc(size * size, sizeof(int))) == NULL) oom();
+    for (int i = 1; i < size; i++)
+        light->grid[i] = light->grid[0] + i * size;
+    return light;
+}
+
+// works out what the light (already off the light map) lights from its
+// new spot, and puts that on the map
+static void light_place(struct game *game, struct light *light, int lvl,
+                        int x, int y, int radius) {
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    assert(radius > 0 && radius <= MAX_FOV_RADIUS);
+    uint64_t start = timing_now();
+    digital_fov(game->map_walls[lvl], game->map_size_x, game->map_size_y,
+                light->grid, x, y, radius);
+    light->lvl    = lvl;
+    light->x      = x;
+    light->y      = y;
+    light->radius = radius;
+    light_add(game, light, 1);
+    if (!game->hosted) timing_add(TIME_LIGHT, start);
+}
+
+// the wall map changed at the cell (see fov_wall); only the lights that
+// reach it can light anything differently
+void light_wall(struct game *game, int lvl, int x, int y) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&game->lights, &search);
+    for (; entry != NULL; entry = Tcl_NextHashEntry(&search)) {
+        struct light *light = Tcl_GetHashValue(entry);
+        int r = light->radius;
+        if (light->lvl != lvl || distance(light->x, light->y, x, y) >= r ||
+            !light->grid[x - light->x + r][y - light->y + r])
+            continue;
+        light_add(game, light, -1);
+        light_place(game, light, light->lvl, light->x, light->y, r);
+    }
+}
+
+// entid - puts the light out
+static int pr_lightdel(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    Tcl_WideInt entid;
+    assert(objc == 2);
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_HashEntry *entry =
+        Tcl_FindHashEntry(&game->lights, (char *) (intptr_t) entid);
+    if (entry == NULL) return TCL_OK;
+    struct light *light = Tcl_GetHashValue(entry);
+    light_add(game, light, -1);
+    light_delete(light);
+    Tcl_DeleteHashEntry(entry);
+    return TCL_OK;
+}
+
+// w {x y ...} - the light level of each of the cells, as a list
+static int pr_lightlevel(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, x, y;
+    Tcl_Obj **list;
+    assert(objc == 3);
+    assert(game->map_light != NULL);
+    Tcl_GetIntFromObj(interp, objv[1], &lvl);
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    Tcl_ListObjGetElements(interp, objv[2], &count, &list);
+    assert((count & 1) == 0);
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < count; i += 2) {
+        Tcl_GetIntFromObj(interp, list[i], &x);
+        Tcl_GetIntFromObj(interp, list[i + 1], &y);
+        assert(x >= 0 && x < game->map_size_x);
+        assert(y >= 0 && y < game->map_size_y);
+        Tcl_ListObjAppendElement(interp, result,
+                                 Tcl_NewIntObj(game->map_light[lvl][x][y]));
+    }
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+// entid w x y radius - a light, or one that has moved or changed size;
+// a light that has not is left be
+static int pr_lightset(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int isnew, lvl, x, y, radius;
+    Tcl_WideInt entid;
+    assert(objc == 6);
+    if (game->map_light == NULL) return TCL_OK; // initmap not yet called
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_GetIntFromObj(interp, objv[2], &lvl);
+    Tcl_GetIntFromObj(interp, objv[3], &x);
+    Tcl_GetIntFromObj(interp, objv[4], &y);
+    Tcl_GetIntFromObj(interp, objv[5], &radius);
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(
+        &game->lights, (char *) (intptr_t) entid, &isnew);
+    struct light *light;
+    if (isnew) {
+        light = light_new();
+        Tcl_SetHashValue(entry, light);
+    } else {
+        light = Tcl_GetHashValue(entry);
+        if (light->lvl == lvl && light->x == x && light->y == y &&
+            light->radius == radius)
+            return TCL_OK;
+        light_add(game, light, -1);
+    }
+    light_place(game, light, lvl, x, y, radius);
+    return TCL_OK;
+}
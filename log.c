@@ -0,0 +1,148 @@
+/* buffered log - lines of JSON collected in a ring buffer that is
+ * written out at the end of each turn, when full, or on the way out.
+ * hosted games (see host.c) log from many threads so the ring is
+ * locked */
+
+#include <sys/uio.h>
+
+#include <pthread.h>
+
+#include "prentice.h"
+
+#define LOG_SIZE 65536
+#define LOG_LINE 4096
+
+static char Log_Ring[LOG_SIZE];
+static size_t Log_Head, Log_Len; // start and length of the unwritten data
+static int Log_Level = LOG_INFO;
+static uint64_t Log_Start;
+static pthread_mutex_t Log_Lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *Level_Names[] = {"debug", "info", "warn", "error", NULL};
+
+#define JSON_CHUNK 256
+
+static void log_append(const char *s, size_t len);
+static void log_drain(void);
+static void log_vmsg(int level, const char *fmt, va_list ap);
+static int pr_log(ClientData clientData, Tcl_Interp *interp, int objc,
+                  Tcl_Obj *CONST objv[]);
+
+// the len bytes of s escaped for the inside of a JSON string, into buf
+// with room for 6 * len; returns how much was written
+size_t json_escape(char *buf, const char *s, size_t len) {
+    char *d = buf;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] == '"' || s[i] == '\\') {
+            *d++ = '\\';
+            *d++ = s[i];
+        } else if ((unsigned char) s[i] < 0x20) {
+            d += sprintf(d, "\\u%04x", s[i]);
+        } else {
+            *d++ = s[i];
+        }
+    }
+    return d - buf;
+}
+
+// as json_escape, out to the file
+void json_fputs(const char *s, FILE *fh) {
+    char buf[6 * JSON_CHUNK];
+    size_t len = strlen(s);
+    while (len) {
+        size_t want = len < JSON_CHUNK ? len : JSON_CHUNK;
+        fwrite(buf, 1, json_escape(buf, s, want), fh);
+        s += want;
+        len -= want;
+    }
+}
+
+static void log_append(const char *s, size_t len) {
+    pthread_mutex_lock(&Log_Lock);
+    if (len > LOG_SIZE - Log_Len) log_drain();
+    size_t tail  = (Log_Head + Log_Len) % LOG_SIZE;
+    size_t first = LOG_SIZE - tail;
+    if (first > len) first = len;
+    memcpy(Log_Ring + tail, s, first);
+    memcpy(Log_Ring, s + first, len - first);
+    Log_Len += len;
+    pthread_mutex_unlock(&Log_Lock);
+}
+
+void log_commands(struct game *game) { LINK_COMMAND(game, "log", pr_log); }
+
+// writes out the ring; the lock must be held
+static void log_drain(void) {
+    while (Log_Len) {
+        struct iovec iov[2];
+        int count    = 1;
+        size_t first = LOG_SIZE - Log_Head;
+        if (first > Log_Len) first = Log_Len;
+        iov[0].iov_base = Log_Ring + Log_Head;
+        iov[0].iov_len  = first;
+        if (Log_Len > first) {
+            iov[1].iov_base = Log_Ring;
+            iov[1].iov_len  = Log_Len - first;
+            count           = 2;
+        }
+        ssize_t ret = writev(STDERR_FILENO, iov, count);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            break; // nowhere to put it
+        }
+        Log_Head = (Log_Head + ret) % LOG_SIZE;
+        Log_Len -= ret;
+    }
+    Log_Head = Log_Len = 0;
+}
+
+void log_flush(void) {
+    pthread_mutex_lock(&Log_Lock);
+    log_drain();
+    pthread_mutex_unlock(&Log_Lock);
+}
+
+// debug, info, etc to the LOG_* value, or -1 if unknown
+int log_level(const char *name) {
+    for (int i = 0; Level_Names[i] != NULL; i++)
+        if (strcmp(name, Level_Names[i]) == 0) return i;
+    return -1;
+}
+
+void log_msg(int level, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    log_vmsg(level, fmt, ap);
+    va_end(ap);
+}
+
+static void log_vmsg(int level, const char *fmt, va_list ap) {
+    assert(level >= LOG_DEBUG && level <= LOG_ERROR);
+    if (level < Log_Level) return;
+    char msg[LOG_LINE], line[LOG_LINE * 6 + 64];
+    vsnprintf(msg, sizeof(msg), fmt, ap);
+    int len = snprintf(line, sizeof(line),
+                       "{\"t\":%.6f,\"level\":\"%s\",\"msg\":\"",
+                       (timing_now() - Log_Start) / 1e9, Level_Names[level]);
+    len += json_escape(line + len, msg, strlen(msg));
+    memcpy(line + len, "\"}\n", 3);
+    log_append(line, len + 3);
+}
+
+static int pr_log(ClientData clientData, Tcl_Interp *interp, int objc,
+                  Tcl_Obj *CONST objv[]) {
+    int level;
+    assert(objc == 3);
+    if (Tcl_GetIndexFromObj(interp, objv[1], Level_Names, "level", 0,
+                            &level) != TCL_OK)
+        return TCL_ERROR;
+    log_msg(level, "%s", Tcl_GetString(objv[2]));
+    return TCL_OK;
+}
+
+void setup_log(int level) {
+    assert(level >= LOG_DEBUG && level <= LOG_ERROR);
+    Log_Level = level;
+    Log_Start = timing_now();
+    atexit(log_flush);
+}
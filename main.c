@@ -3,15 +3,43 @@
 
 #include "prentice.h"
 
-Tcl_Interp *Interp;
+struct game *Game;
+
+static int Autosave_Turns = 100; // -a
+static int Log_Threshold  = LOG_INFO;
+static char *Batch_Script, *Profile_File, *Record_File, *Replay_File,
+    *Spectate_Socket;
+static int Host_Games;   // run this many games headless instead (-H)
+static int Host_Threads; // over this many threads (-j)
+static int No_Save;         // skip the initial game.db save
+static int Simulate_Ticks;  // run this many turns headless instead (-t)
+static int Startup_Profile; // report how long each startup phase took
+static int Warm_Procs;      // byte-compile all the TCL procs at startup
+
+#define MAX_PHASES 16
+static struct {
+    char name[16];
+    long usec;
+} Phases[MAX_PHASES];
+static int Phase_Count;
+static struct timespec Phase_Start;
+static FILE *Phase_Report; // the terminal, as stderr goes to the log
+
+static struct option Long_Opts[] = {
+    {"startup-profile", no_argument, &Startup_Profile, 1},
+    {NULL, 0, NULL, 0}};
 
 static void cleanup(void);
 static void emit_help(void);
-static void include_tcl(char *file);
 static int pr_getch(ClientData clientData, Tcl_Interp *interp, int objc,
                     Tcl_Obj *CONST objv[]);
+static int pr_startup_phase(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]);
 static void setup_curses(void);
-static void setup_tcl(int argc, char *argv[]);
+static void simulate(void);
+static void startup_phase(const char *name);
+static void startup_report(void);
+static void setup_tcl(void);
 static void stacktrace(int code);
 
 int main(int argc, char *argv[]) {
@@ -25,10 +53,36 @@ int main(int argc, char *argv[]) {
 #endif
 
     setlocale(LC_ALL, "");
+    clock_gettime(CLOCK_MONOTONIC, &Phase_Start);
 
     int ch;
-    while ((ch = getopt(argc, argv, "h?")) != -1) {
+    while ((ch = getopt_long(argc, argv, "a:b:H:h?j:l:nP:p:r:S:s:t:w",
+                             Long_Opts, NULL)) != -1) {
         switch (ch) {
+        case 0: break;
+        case 'a':
+            if ((Autosave_Turns = atoi(optarg)) < 0) emit_help();
+            break;
+        case 'b': Batch_Script = optarg; break;
+        case 'H':
+            if ((Host_Games = atoi(optarg)) < 1) emit_help();
+            break;
+        case 'j':
+            if ((Host_Threads = atoi(optarg)) < 1) emit_help();
+            break;
+        case 'l':
+            if ((Log_Threshold = log_level(optarg)) == -1) emit_help();
+            break;
+        case 'n': No_Save = 1; break;
+        case 'P': Profile_File = optarg; break;
+        case 'p': Replay_File = optarg; break;
+        case 'r': Record_File = optarg; break;
+        case 'S': spectate_open(Spectate_Socket = optarg); break;
+        case 's': snapshot_open(optarg); break;
+        case 't':
+            if ((Simulate_Ticks = atoi(optarg)) < 1) emit_help();
+            break;
+        case 'w': Warm_Procs = 1; break;
         case 'h':
         case '?':
         default:
@@ -38,22 +92,59 @@ int main(int argc, char *argv[]) {
     }
     argc -= optind;
     argv += optind;
+    if (Host_Games && !Batch_Script) emit_help();
 
-    setup_jsf();
-    setup_tcl(argc, argv);
+    uint32_t seed = setup_jsf();
+    if (Replay_File) raninit(seed = replay_open(Replay_File));
+    if (Record_File) record_open(Record_File, seed);
+    startup_phase("setup_jsf");
+    setup_log(Log_Threshold);
+    setup_timing();
+    if (Host_Games) {
+        freopen("log", "w", stderr); // DBG
+        setvbuf(stderr, (char *) NULL, _IONBF, (size_t) 0);
+        if (!Host_Threads) Host_Threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+        host_run(Batch_Script, Host_Games, Host_Threads);
+        exit(EXIT_SUCCESS);
+    }
+    setup_tcl();
+    if (Profile_File) profile_start(Game, Profile_File);
+    startup_phase("setup_tcl");
     setup_curses();
     setup_map();
     setup_messages();
+    startup_phase("setup_curses");
 
+    if (Startup_Profile) {
+        int fd = dup(STDERR_FILENO);
+        if (fd == -1 || (Phase_Report = fdopen(fd, "w")) == NULL)
+            err(1, "dup stderr failed");
+    }
     freopen("log", "w", stderr); // DBG
+    // unbuffered for err(3) and such; the log does its own buffering
     setvbuf(stderr, (char *) NULL, _IONBF, (size_t) 0);
 
-    include_tcl("init.tcl");
-    int ret;
-    if ((ret = Tcl_EvalEx(Interp, "use_energy", -1, TCL_EVAL_GLOBAL)) !=
+    // -t saves once it is done instead
+    int ret, autosave = No_Save || Simulate_Ticks ? 0 : Autosave_Turns;
+    if ((ret = game_init(Game, argc == 1 ? argv[0] : NULL, !No_Save,
+                         autosave, Warm_Procs)) != TCL_OK) {
+        if (ret == TCL_ERROR) stacktrace(ret);
+        errx(1, "init.tcl failed: %s", Tcl_GetStringResult(Game->interp));
+    }
+    if (Simulate_Ticks) simulate();
+    if (Batch_Script) {
+        if ((ret = Tcl_EvalFile(Game->interp, Batch_Script)) != TCL_OK) {
+            if (ret == TCL_ERROR) stacktrace(ret);
+            errx(1, "%s failed: %s", Batch_Script,
+                 Tcl_GetStringResult(Game->interp));
+        }
+        exit(EXIT_SUCCESS);
+    }
+    replay_start();
+    if ((ret = Tcl_EvalEx(Game->interp, "use_energy", -1, TCL_EVAL_GLOBAL)) !=
         TCL_OK) {
         if (ret == TCL_ERROR) stacktrace(ret);
-        errx(1, "TCL failed: %s", Tcl_GetStringResult(Interp));
+        errx(1, "TCL failed: %s", Tcl_GetStringResult(Game->interp));
     }
 
     exit(1); // NOTREACHED
@@ -65,16 +156,23 @@ static void cleanup(void) {
     echo();
     nl();
     endwin();
+    // once the screen is given back, so the table is not drawn over
+    startup_report();
 }
 
 inline static void emit_help(void) {
-    fputs("Usage: ./prentice [dbfile]", stderr);
+    fputs("Usage: ./prentice [-nw] [-a turns] [-l level] [-P profile]\n"
+          "  [-S socket] [-s snapshot] [--startup-profile]\n"
+          "  [-b script | -p replay | -r record | -t ticks] [dbfile]\n"
+          "       ./prentice -H games [-j threads] [-l level] -b script\n",
+          stderr);
     exit(EX_USAGE);
 }
 
 // post-ncurses setup bailouts
 void fatal(const char *const fmt, ...) {
     assert(fmt);
+    log_flush();
     clear();
     attrset(A_NORMAL);
     move(LINES - 2, 0);
@@ -87,25 +185,51 @@ void fatal(const char *const fmt, ...) {
     exit(1);
 }
 
-inline static void include_tcl(char *file) {
-    int ret;
-    if ((ret = Tcl_EvalFile(Interp, file)) != TCL_OK) {
-        if (ret == TCL_ERROR) stacktrace(ret);
-        errx(1, "%s failed: %s", file, Tcl_GetStringResult(Interp));
-    }
-}
-
 static int pr_getch(ClientData clientData, Tcl_Interp *interp, int objc,
                     Tcl_Obj *CONST objv[]) {
     int ch;
-    ch = getch();
+    log_flush();
+    timing_poll();
+    if (draw_messages()) doupdate();
+    if (replaying()) {
+        spectate_pump();
+        ch = replay_key();
+    } else {
+        uint64_t start = timing_now();
+        spectate_wait();
+        ch = getch();
+        timing_add(TIME_GETCH, start);
+        record_key(ch);
+    }
     if (ch == ERR) ch = 27; // ESC
     Tcl_SetObjResult(interp, Tcl_NewIntObj(ch));
     return TCL_OK;
 }
 
+static int pr_startup_phase(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 2);
+    startup_phase(Tcl_GetString(objv[1]));
+    return TCL_OK;
+}
+
 inline static void setup_curses(void) {
-    initscr();
+    if (Batch_Script || Replay_File || Simulate_Ticks) {
+        // draw as usual but to nowhere (or only to any spectators), and
+        // at the usual size
+        FILE *devnull;
+        if ((devnull = fopen("/dev/null", "r+")) == NULL)
+            err(EX_OSFILE, "/dev/null");
+        if (newterm("vt100", Spectate_Socket ? spectate_screen(-1) : devnull,
+                    devnull) == NULL)
+            errx(EX_UNAVAILABLE, "newterm failed");
+    } else if (Spectate_Socket) {
+        if (newterm(NULL, spectate_screen(STDOUT_FILENO), stdin) == NULL)
+            errx(EX_UNAVAILABLE, "newterm failed");
+        spectate_tty();
+    } else {
+        initscr();
+    }
     if (LINES < NEED_ROWS || COLS < NEED_COLS) {
         endwin();
         warnx("terminal must be at least %dx%d", NEED_COLS, NEED_ROWS);
@@ -125,22 +249,84 @@ inline static void setup_curses(void) {
     signal(SIGWINCH, SIG_IGN);
 }
 
-inline static void setup_tcl(int argc, char *argv[]) {
-    if ((Interp = Tcl_CreateInterp()) == NULL)
-        errx(EX_OSERR, "Tcl_CreateInterp failed");
-    if (Tcl_Init(Interp) == TCL_ERROR) errx(EX_OSERR, "Tcl_Init failed");
-    LINK_COMMAND("getch", pr_getch);
-    Tcl_SetVar2(Interp, "dbfile", NULL, argc == 1 ? argv[0] : NULL, 0);
+inline static void setup_tcl(void) {
+    Game = game_new(0);
+    LINK_COMMAND(Game, "getch", pr_getch);
+    LINK_COMMAND(Game, "startup_phase", pr_startup_phase);
+}
+
+// ages the game by the given number of turns, saves it unless -n, and
+// exits
+static void simulate(void) {
+    Tcl_Interp *interp = Game->interp;
+    char script[64];
+    snprintf(script, sizeof(script), "simulate %d", Simulate_Ticks);
+    int ret;
+    if ((ret = Tcl_EvalEx(interp, script, -1, TCL_EVAL_GLOBAL)) != TCL_OK) {
+        if (ret == TCL_ERROR) stacktrace(ret);
+        errx(1, "simulate failed: %s", Tcl_GetStringResult(interp));
+    }
+    // ticks secs rate
+    Tcl_Obj *result = Tcl_GetObjResult(interp);
+    Tcl_IncrRefCount(result);
+    const char *names[3] = {"ticks", "secs", "rate"};
+    double values[3] = {0};
+    for (int i = 0; i < 3; i++) {
+        Tcl_Obj *key = Tcl_NewStringObj(names[i], -1), *value;
+        Tcl_IncrRefCount(key);
+        if (Tcl_DictObjGet(NULL, result, key, &value) == TCL_OK && value)
+            Tcl_GetDoubleFromObj(NULL, value, &values[i]);
+        Tcl_DecrRefCount(key);
+    }
+    Tcl_DecrRefCount(result);
+    if (!No_Save &&
+        (ret = Tcl_EvalEx(interp, "save_db", -1, TCL_EVAL_GLOBAL)) != TCL_OK) {
+        if (ret == TCL_ERROR) stacktrace(ret);
+        errx(1, "save_db failed: %s", Tcl_GetStringResult(interp));
+    }
+    cleanup();
+    printf("simulated %.0f ticks %.6f s %.1f ticks/s\n", values[0],
+           values[1], values[2]);
+    exit(EXIT_SUCCESS);
 }
 
 static void stacktrace(int code) {
-    Tcl_Obj *options = Tcl_GetReturnOptions(Interp, code);
+    Tcl_Obj *options = Tcl_GetReturnOptions(Game->interp, code);
     Tcl_Obj *key     = Tcl_NewStringObj("-errorinfo", -1);
     Tcl_Obj *stacktrace;
     Tcl_IncrRefCount(key);
     Tcl_DictObjGet(NULL, options, key, &stacktrace);
     Tcl_DecrRefCount(key);
     cleanup();
+    log_flush();
     fputs(Tcl_GetStringFromObj(stacktrace, NULL), stderr);
     fputs("\n", stderr);
 }
+
+// marks the end of a startup phase (that began at the end of the
+// previous phase) if --startup-profile is on
+static void startup_phase(const char *name) {
+    if (!Startup_Profile || Phase_Count >= MAX_PHASES) return;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    snprintf(Phases[Phase_Count].name, sizeof(Phases[0].name), "%s", name);
+    Phases[Phase_Count].usec = (now.tv_sec - Phase_Start.tv_sec) * 1000000 +
+                               (now.tv_nsec - Phase_Start.tv_nsec) / 1000;
+    Phase_Count++;
+    Phase_Start = now;
+}
+
+// the startup phase table, to the terminal at exit
+static void startup_report(void) {
+    if (Phase_Report == NULL) return;
+    long total = 0;
+    for (int i = 0; i < Phase_Count; i++) {
+        fprintf(Phase_Report, "startup %-15s %9.3f ms\n", Phases[i].name,
+                Phases[i].usec / 1000.0);
+        total += Phases[i].usec;
+    }
+    fprintf(Phase_Report, "startup %-15s %9.3f ms\n", "total",
+            total / 1000.0);
+    fclose(Phase_Report);
+    Phase_Report = NULL;
+}
@@ -3,14 +3,21 @@
 #include "digital-fov.h"
 #include "prentice.h"
 
-char ***Map_Chars;
-int **Map_Fov, ***Map_Seen, ***Map_Walls, Map_Size_W, Map_Size_X, Map_Size_Y;
 WINDOW *Map_View;
 
 static int distance(int x1, int y1, int x2, int y2);
-static void drawmap(int lvl, int entx, int enty, int radius);
+static void drawmap(struct game *game, int **fov, int lvl, int entx,
+                    int enty, int radius);
 static char **make_charmap(int x, int y);
 static int **make_intmap(int x, int y);
+static void mark_seen(struct game *game, int **fov, int lvl, int entx,
+                      int enty, int radius);
+static int pr_initmap(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_lineofsight(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]);
+static int pr_refreshmap(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]);
 
 // also borrowed from the digital-fov code repo (Chebyshev distance)
 inline static int distance(int ax, int ay, int bx, int by) {
@@ -21,7 +28,8 @@ inline static int distance(int ax, int ay, int bx, int by) {
 
 #define MAP_PRINT(i, j, ch) mvwaddch(Map_View, j, i, ch)
 
-inline static void drawmap(int lvl, int entx, int enty, int radius) {
+inline static void drawmap(struct game *game, int **fov, int lvl, int entx,
+                           int enty, int radius) {
     werase(Map_View);
     int startx = entx - VIEW_OFFSET_X;
     int starty = enty - VIEW_OFFSET_Y;
@@ -34,7 +42,7 @@ inline static void drawmap(int lvl, int entx, int enty, int radius) {
     } else {
         basex  = startx;
         viewx  = 0;
-        widthx = Map_Size_X - basex;
+        widthx = game->map_size_x - basex;
         if (VIEW_SIZE_X < widthx) widthx = VIEW_SIZE_X;
     }
     if (starty < 0) {
@@ -44,7 +52,7 @@ inline static void drawmap(int lvl, int entx, int enty, int radius) {
     } else {
         basey  = starty;
         viewy  = 0;
-        widthy = Map_Size_Y - basey;
+        widthy = game->map_size_y - basey;
         if (VIEW_SIZE_Y < widthy) widthy = VIEW_SIZE_Y;
     }
     for (int i = 0; i < widthx; i++) {
@@ -52,8 +60,9 @@ inline static void drawmap(int lvl, int entx, int enty, int radius) {
         for (int j = 0; j < widthy; j++) {
             int mapy = basey + j;
             if (distance(entx, enty, mapx, mapy) < radius &&
-                Map_Fov[mapx - entx + radius][mapy - enty + radius]) {
-                int ch = Map_Chars[lvl][mapx][mapy];
+                fov[mapx - entx + radius][mapy - enty + radius] &&
+                game->map_light[lvl][mapx][mapy]) {
+                int ch = game->map_chars[lvl][mapx][mapy];
                 switch (ch) {
                 case '&': ch = ACS_DIAMOND;
                 case '#':
@@ -76,10 +85,9 @@ inline static void drawmap(int lvl, int entx, int enty, int radius) {
                     wattroff(Map_View, PAINT_WHITE);
                     wattroff(Map_View, A_BOLD);
                 }
-                Map_Seen[lvl][i][j] = 1;
             } else {
-                if (Map_Seen[lvl][i][j]) {
-                    int ch = Map_Chars[lvl][mapx][mapy];
+                if (game->map_seen[lvl][mapx][mapy]) {
+                    int ch = game->map_chars[lvl][mapx][mapy];
                     wattron(Map_View, A_DIM);
                     switch (ch) {
                     case '&': ch = ACS_DIAMOND;
@@ -128,12 +136,57 @@ static int **make_intmap(int x, int y) {
     return map;
 }
 
+void map_commands(struct game *game) {
+    LINK_COMMAND(game, "initmap", pr_initmap);
+    LINK_COMMAND(game, "lineofsight", pr_lineofsight);
+    LINK_COMMAND(game, "refreshmap", pr_refreshmap);
+}
+
+// what is drawn as in view (in the FOV, and lit) is remembered as
+// seen, whether or not it is drawn this time
+static void mark_seen(struct game *game, int **fov, int lvl, int entx,
+                      int enty, int radius) {
+    for (int i = 0; i <= 2 * radius; i++) {
+        int mapx = entx - radius + i;
+        if (mapx < 0 || mapx >= game->map_size_x) continue;
+        for (int j = 0; j <= 2 * radius; j++) {
+            int mapy = enty - radius + j;
+            if (mapy < 0 || mapy >= game->map_size_y) continue;
+            if (distance(entx, enty, mapx, mapy) < radius && fov[i][j] &&
+                game->map_light[lvl][mapx][mapy])
+                game->map_seen[lvl][mapx][mapy] = 1;
+        }
+    }
+}
+
+void map_free(struct game *game) {
+    if (game->map_chars == NULL) return;
+    for (int w = 0; w < game->map_size_w; w++) {
+        free(game->map_chars[w][0]);
+        free(game->map_chars[w]);
+        free(game->map_light[w][0]);
+        free(game->map_light[w]);
+        free(game->map_seen[w][0]);
+        free(game->map_seen[w]);
+        free(game->map_solid[w][0]);
+        free(game->map_solid[w]);
+        free(game->map_walls[w][0]);
+        free(game->map_walls[w]);
+    }
+    free(game->map_chars);
+    free(game->map_light);
+    free(game->map_seen);
+    free(game->map_solid);
+    free(game->map_walls);
+}
+
 static int pr_initmap(ClientData clientData, Tcl_Interp *interp, int objc,
                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
     assert(objc > 1);
-    assert(Map_Chars == NULL);
-    assert(Map_Seen == NULL);
-    assert(Map_Walls == NULL);
+    assert(game->map_chars == NULL);
+    assert(game->map_seen == NULL);
+    assert(game->map_walls == NULL);
 
     int count, a, b;
     Tcl_Obj **list;
@@ -143,100 +196,138 @@ static int pr_initmap(ClientData clientData, Tcl_Interp *interp, int objc,
     assert(count == 6);
     Tcl_GetIntFromObj(interp, list[0], &a);
     Tcl_GetIntFromObj(interp, list[2], &b);
-    Map_Size_X = b - a + 1;
+    game->map_size_x = b - a + 1;
     Tcl_GetIntFromObj(interp, list[1], &a);
     Tcl_GetIntFromObj(interp, list[3], &b);
-    Map_Size_Y = b - a + 1;
+    game->map_size_y = b - a + 1;
     Tcl_GetIntFromObj(interp, list[4], &a);
     Tcl_GetIntFromObj(interp, list[5], &b);
-    Map_Size_W = b - a + 1;
-    assert(Map_Size_W > 0);
-    assert(Map_Size_X > 0);
-    assert(Map_Size_Y > 0);
+    game->map_size_w = b - a + 1;
+    assert(game->map_size_w > 0);
+    assert(game->map_size_x > 0);
+    assert(game->map_size_y > 0);
+    assert(objc == 2 + 2 * game->map_size_w);
+
+    size_t levels = game->map_size_w;
+    if ((game->map_chars = malloc(sizeof(char *) * levels)) == NULL) oom();
+    if ((game->map_light = malloc(sizeof(int *) * levels)) == NULL) oom();
+    if ((game->map_seen = malloc(sizeof(int *) * levels)) == NULL) oom();
+    if ((game->map_solid = malloc(sizeof(int *) * levels)) == NULL) oom();
+    if ((game->map_walls = malloc(sizeof(int *) * levels)) == NULL) oom();
 
-    if ((Map_Chars = malloc(sizeof(char *) * Map_Size_W)) == NULL) oom();
-    if ((Map_Seen = malloc(sizeof(int *) * Map_Size_W)) == NULL) oom();
-    if ((Map_Walls = malloc(sizeof(int *) * Map_Size_W)) == NULL) oom();
+    for (int w = 0; w < game->map_size_w; w++) {
+        game->map_chars[w] = make_charmap(game->map_size_x, game->map_size_y);
+        game->map_light[w] = make_intmap(game->map_size_x, game->map_size_y);
+        game->map_seen[w]  = make_intmap(game->map_size_x, game->map_size_y);
+        game->map_solid[w] = make_intmap(game->map_size_x, game->map_size_y);
+        game->map_walls[w] = make_intmap(game->map_size_x, game->map_size_y);
 
-    for (int w = 0; w < Map_Size_W; w++) {
-        Map_Chars[w] = make_charmap(Map_Size_X, Map_Size_Y);
-        Map_Seen[w]  = make_intmap(Map_Size_X, Map_Size_Y);
-        Map_Walls[w] = make_intmap(Map_Size_X, Map_Size_Y);
+        // the characters come from the cell stacks (see cells.c)
 
-        // topmost character as x,y,ch,zlevel (zlevel is unused here)
+        // is-wall?
         Tcl_ListObjGetElements(interp, objv[w * 2 + 2], &count, &list);
-        assert(count % 4 == 0);
-        for (int i = 0; i < count; i += 4) {
+        assert((count & 1) == 0);
+        for (int i = 0; i < count; i += 2) {
             Tcl_GetIntFromObj(interp, list[i], &a);
             Tcl_GetIntFromObj(interp, list[i + 1], &b);
-            assert(a >= 0 && a < Map_Size_X);
-            assert(b >= 0 && b < Map_Size_Y);
-            int ch;
-            Tcl_GetIntFromObj(interp, list[i + 2], &ch);
-            assert(isprint(ch));
-            Map_Chars[w][a][b] = ch;
+            game->map_seen[w][a][b]  = 0;
+            game->map_walls[w][a][b] = 1;
         }
 
-        // is-wall?
+        // is-solid? (for pathfinding)
         Tcl_ListObjGetElements(interp, objv[w * 2 + 3], &count, &list);
         assert((count & 1) == 0);
         for (int i = 0; i < count; i += 2) {
             Tcl_GetIntFromObj(interp, list[i], &a);
             Tcl_GetIntFromObj(interp, list[i + 1], &b);
-            Map_Seen[w][a][b]  = 0;
-            Map_Walls[w][a][b] = 1;
+            game->map_solid[w][a][b] = 1;
         }
     }
 
     return TCL_OK;
 }
 
-static int pr_refreshmap(ClientData clientData, Tcl_Interp *interp, int objc,
-                         Tcl_Obj *CONST objv[]) {
-    int count, lvl, entx, enty, radius;
+// which of the list of x y targets can be seen from the given w,x,y
+// location, as a list of 0 or 1 for each
+static int pr_lineofsight(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, entx, enty;
     Tcl_Obj **list;
-    assert(objc == 4);
+    assert(objc == 3);
 
-    // w,x,y location of entity to draw FOV relative to
     Tcl_ListObjGetElements(interp, objv[1], &count, &list);
     assert(count == 3);
     Tcl_GetIntFromObj(interp, list[0], &lvl);
     Tcl_GetIntFromObj(interp, list[1], &entx);
     Tcl_GetIntFromObj(interp, list[2], &enty);
-    assert(lvl >= 0 && lvl < Map_Size_W);
-    assert(entx >= 0 && entx < Map_Size_X);
-    assert(enty >= 0 && enty < Map_Size_Y);
+    assert(lvl >= 0 && lvl < game->map_size_w);
 
-    // dirty cells to update - entid,x,y,ch,is-wall?
     Tcl_ListObjGetElements(interp, objv[2], &count, &list);
-    assert(count % 5 == 0);
-    for (int i = 0; i < count; i += 5) {
-        int a, b, ch, wall;
-        Tcl_GetIntFromObj(interp, list[i + 1], &a);
-        Tcl_GetIntFromObj(interp, list[i + 2], &b);
-        Tcl_GetIntFromObj(interp, list[i + 3], &ch);
-        Tcl_GetIntFromObj(interp, list[i + 4], &wall);
-        assert(a >= 0 && a < Map_Size_X);
-        assert(b >= 0 && b < Map_Size_Y);
-        assert(isprint(ch));
-        Map_Chars[lvl][a][b] = ch;
-        Map_Walls[lvl][a][b] = wall;
-    }
+    assert((count & 1) == 0);
+    int stack_buf[3 * 64], *targets = stack_buf;
+    if (count / 2 > 64 &&
+        (targets = malloc(sizeof(int) * 3 * (count / 2))) == NULL)
+        oom();
+    int *seen = targets + count;
+    for (int i = 0; i < count; i++)
+        Tcl_GetIntFromObj(interp, list[i], &targets[i]);
+    digital_los_batch(game->map_walls[lvl], game->map_size_x,
+                      game->map_size_y, entx, enty, count / 2, targets, seen);
+    Tcl_Obj *result = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < count / 2; i++)
+        Tcl_ListObjAppendElement(interp, result, Tcl_NewBooleanObj(seen[i]));
+    if (targets != stack_buf) free(targets);
+    Tcl_SetObjResult(interp, result);
+    return TCL_OK;
+}
+
+static int pr_refreshmap(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, entx, enty, radius, draw = 1;
+    Tcl_WideInt entid;
+    Tcl_Obj **list;
+    assert(objc == 4 || objc == 5);
+
+    // entity to draw FOV relative to, and its w,x,y location
+    Tcl_GetWideIntFromObj(interp, objv[1], &entid);
+    Tcl_ListObjGetElements(interp, objv[2], &count, &list);
+    assert(count == 3);
+    Tcl_GetIntFromObj(interp, list[0], &lvl);
+    Tcl_GetIntFromObj(interp, list[1], &entx);
+    Tcl_GetIntFromObj(interp, list[2], &enty);
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(entx >= 0 && entx < game->map_size_x);
+    assert(enty >= 0 && enty < game->map_size_y);
 
+    // the map layers are kept current as things move (by cellmove,
+    // mapwall, lightset) so there is nothing more to update here. the
+    // radius is how far can be seen, of what is lit
     Tcl_GetIntFromObj(interp, objv[3], &radius);
     assert(radius > 0 && radius <= MAX_FOV_RADIUS);
+    // draw? - runs only draw where they stop
+    if (objc == 5) Tcl_GetBooleanFromObj(interp, objv[4], &draw);
 
-    digital_fov(Map_Walls[lvl], Map_Size_X, Map_Size_Y, Map_Fov, entx, enty,
-                radius);
-    drawmap(lvl, entx, enty, radius);
-    doupdate();
+    int **fov = fov_for(game, entid, lvl, entx, enty, radius);
+    mark_seen(game, fov, lvl, entx, enty, radius);
+    if (game->hosted) return TCL_OK; // nothing of it is on the screen
+    if (draw) {
+        uint64_t start = timing_now();
+        drawmap(game, fov, lvl, entx, enty, radius);
+        timing_add(TIME_DRAWMAP, start);
+        draw_messages();
+        start = timing_now();
+        doupdate();
+        timing_add(TIME_DOUPDATE, start);
+        spectate_pump();
+    }
+    // every turn, drawn or not, so readers see the runs go by
+    snapshot_publish(lvl, entx, enty);
     return TCL_OK;
 }
 
 void setup_map(void) {
-    Map_Fov = make_intmap(2 * MAX_FOV_RADIUS + 1, 2 * MAX_FOV_RADIUS + 1);
-    LINK_COMMAND("initmap", pr_initmap);
-    LINK_COMMAND("refreshmap", pr_refreshmap);
     Map_View = subwin(stdscr, VIEW_SIZE_Y, VIEW_SIZE_X, 0, 0);
     leaveok(Map_View, TRUE);
 }
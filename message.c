@@ -1,4 +1,5 @@
-/* scrolling messages */
+/* messages, kept in a ring of interned strings so older ones can be
+ * brought back up, and drawn at most once per turn */
 
 #include "prentice.h"
 
@@ -8,25 +9,220 @@ WINDOW *Messages;
 #define VIEW_ROWS NEED_ROWS
 #define VIEW_COLS 80 - (VIEW_SIZE_X + 2)
 
+#define MSG_HISTORY 1024
+
+struct message {
+    Tcl_HashEntry *text; // interned, value is a reference count
+    Tcl_WideInt turn;    // of the most recent repeat
+    int count;           // repeats collapsed into this one
+};
+
+// the messages of one game
+struct messages {
+    struct message history[MSG_HISTORY];
+    int newest, count;
+    int dirty;  // logged to since the last draw
+    int logged; // count, repeats included, so runs can tell to stop
+    Tcl_HashTable texts;
+};
+
+static int lines_for(struct messages *msgs, struct message *msg);
+static int pr_logcount(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_logmsg(ClientData clientData, Tcl_Interp *interp, int objc,
+                     Tcl_Obj *CONST objv[]);
+static int pr_scrollback(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]);
+static void release(struct message *msg);
+static void show_message(WINDOW *win, struct messages *msgs,
+                         struct message *msg);
+
+#define TEXT_OF(msgs, msg)                                                     \
+    ((const char *) Tcl_GetHashKey(&(msgs)->texts, (msg)->text))
+// nth most recent message, 0 being the newest
+#define NTH_NEWEST(msgs, n)                                                    \
+    (&(msgs)->history[((msgs)->newest - (n) + MSG_HISTORY) % MSG_HISTORY])
+
+// redraws the message window if anything was logged since the last
+// draw; the caller must doupdate() if this returns true
+int draw_messages(void) {
+    struct messages *msgs = Game->messages;
+    if (!msgs->dirty) return 0;
+    msgs->dirty = 0;
+    int first = 0, lines = 0;
+    while (first < msgs->count) {
+        lines += lines_for(msgs, NTH_NEWEST(msgs, first));
+        if (lines > VIEW_ROWS) break;
+        first++;
+    }
+    // the newest, clipped, if it alone is too long for the window
+    if (first == 0 && msgs->count) first = 1;
+    werase(Messages);
+    wmove(Messages, 0, 0);
+    while (first-- > 0) {
+        show_message(Messages, msgs, NTH_NEWEST(msgs, first));
+        if (first && getcurx(Messages) != 0) waddch(Messages, '\n');
+    }
+    wnoutrefresh(Messages);
+    return 1;
+}
+
+inline static int lines_for(struct messages *msgs, struct message *msg) {
+    size_t len = strlen(TEXT_OF(msgs, msg));
+    if (msg->count > 1) len += snprintf(NULL, 0, " (x%d)", msg->count);
+    return len == 0 ? 1 : (int) ((len + VIEW_COLS - 1) / (VIEW_COLS));
+}
+
+void message_commands(struct game *game) {
+    struct messages *msgs;
+    if ((msgs = calloc(1, sizeof(struct messages))) == NULL) oom();
+    msgs->newest = -1;
+    Tcl_InitHashTable(&msgs->texts, TCL_STRING_KEYS);
+    game->messages = msgs;
+    LINK_COMMAND(game, "logcount", pr_logcount);
+    LINK_COMMAND(game, "logmsg", pr_logmsg);
+    LINK_COMMAND(game, "scrollback", pr_scrollback);
+}
+
+void message_free(struct game *game) {
+    Tcl_DeleteHashTable(&game->messages->texts);
+    free(game->messages);
+}
+
+// the nth most recent message, 0 being the newest; returns 0 if there
+// are not that many
+int message_nth(struct game *game, int n, const char **text,
+                Tcl_WideInt *turn, int *count) {
+    struct messages *msgs = game->messages;
+    if (n >= msgs->count) return 0;
+    struct message *msg = NTH_NEWEST(msgs, n);
+    *text               = TEXT_OF(msgs, msg);
+    *turn               = msg->turn;
+    *count              = msg->count;
+    return 1;
+}
+
+// how many messages have been logged, repeats included
+static int pr_logcount(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    Tcl_SetObjResult(interp, Tcl_NewIntObj(game->messages->logged));
+    return TCL_OK;
+}
+
 static int pr_logmsg(ClientData clientData, Tcl_Interp *interp, int objc,
                      Tcl_Obj *CONST objv[]) {
+    struct game *game     = clientData;
+    struct messages *msgs = game->messages;
     assert(objc == 2);
     const char *msg = Tcl_GetString(objv[1]);
     assert(msg != NULL);
-    static int shown = -1;
-    if (shown >= VIEW_ROWS) shown = VIEW_ROWS - 1;
-    if (shown > -1) mvwaddch(Messages, shown, VIEW_COLS - 1, '\n'); // scroll
-    shown++;
-    waddstr(Messages, msg);
-    wnoutrefresh(Messages);
-    doupdate();
+    int isnew;
+    Tcl_HashEntry *text = Tcl_CreateHashEntry(&msgs->texts, msg, &isnew);
+    if (isnew) Tcl_SetHashValue(text, (ClientData) 0);
+    msgs->dirty = 1;
+    msgs->logged++;
+    struct message *newest;
+    if (msgs->count) {
+        newest = NTH_NEWEST(msgs, 0);
+        if (newest->text == text) {
+            newest->count++;
+            newest->turn = game->turn;
+            return TCL_OK;
+        }
+    }
+    // take the reference first as the text may be that of the message
+    // being pushed out
+    Tcl_SetHashValue(text,
+                     (ClientData) ((intptr_t) Tcl_GetHashValue(text) + 1));
+    msgs->newest = (msgs->newest + 1) % MSG_HISTORY;
+    newest       = NTH_NEWEST(msgs, 0);
+    if (msgs->count == MSG_HISTORY)
+        release(newest);
+    else
+        msgs->count++;
+    newest->text  = text;
+    newest->turn  = game->turn;
+    newest->count = 1;
     return TCL_OK;
 }
 
+// full screen view of the message history, newest at the bottom
+static int pr_scrollback(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    if (game->hosted) return TCL_OK;
+    struct messages *msgs = game->messages;
+    int ch, page = LINES - 1, ret = TCL_OK, top = msgs->count - page;
+    if (top < 0) top = 0;
+    WINDOW *view = newwin(LINES, COLS, 0, 0);
+    char *line;
+    if (view == NULL || (line = malloc(COLS + 1)) == NULL) oom();
+    while (1) {
+        werase(view);
+        for (int i = 0; i < page && top + i < msgs->count; i++) {
+            struct message *msg =
+                NTH_NEWEST(msgs, msgs->count - 1 - (top + i));
+            int len = snprintf(line, COLS + 1, "%6lld %s",
+                               (long long) msg->turn, TEXT_OF(msgs, msg));
+            if (msg->count > 1 && len < COLS)
+                snprintf(line + len, COLS + 1 - len, " (x%d)", msg->count);
+            mvwaddstr(view, i, 0, line);
+        }
+        wattron(view, A_REVERSE);
+        mvwprintw(view, LINES - 1, 0,
+                  " messages %d-%d of %d (j k space b, q to exit) ",
+                  msgs->count ? top + 1 : 0,
+                  top + page < msgs->count ? top + page : msgs->count,
+                  msgs->count);
+        wattroff(view, A_REVERSE);
+        wrefresh(view);
+        // by way of the getch command, as for any other key, so these
+        // are recorded, replayed, timed, and profiled too
+        if ((ret = Tcl_EvalEx(interp, "getch", -1, TCL_EVAL_GLOBAL)) !=
+                TCL_OK ||
+            (ret = Tcl_GetIntFromObj(interp, Tcl_GetObjResult(interp),
+                                     &ch)) != TCL_OK)
+            break;
+        Tcl_ResetResult(interp);
+        if (ch == 'j')
+            top++;
+        else if (ch == 'k')
+            top--;
+        else if (ch == ' ')
+            top += page;
+        else if (ch == 'b')
+            top -= page;
+        else if (ch == 'q' || ch == 27)
+            break;
+        if (top > msgs->count - page) top = msgs->count - page;
+        if (top < 0) top = 0;
+    }
+    free(line);
+    delwin(view);
+    touchwin(stdscr);
+    wnoutrefresh(stdscr);
+    doupdate();
+    spectate_pump();
+    return ret;
+}
+
+// drops a reference to the text of the message being pushed out
+static void release(struct message *msg) {
+    intptr_t refs = (intptr_t) Tcl_GetHashValue(msg->text) - 1;
+    if (refs == 0)
+        Tcl_DeleteHashEntry(msg->text);
+    else
+        Tcl_SetHashValue(msg->text, (ClientData) refs);
+}
+
 void setup_messages(void) {
-    LINK_COMMAND("logmsg", pr_logmsg);
     Messages = subwin(stdscr, VIEW_ROWS, VIEW_COLS, 0, VIEW_SIZE_X + 1);
     leaveok(Messages, TRUE);
-    scrollok(Messages, TRUE);
-    wsetscrreg(Messages, 0, NEED_ROWS - 1);
+}
+
+inline static void show_message(WINDOW *win, struct messages *msgs,
+                                struct message *msg) {
+    waddstr(win, TEXT_OF(msgs, msg));
+    if (msg->count > 1) wprintw(win, " (x%d)", msg->count);
 }
@@ -0,0 +1,166 @@
+/* pathfinding commands - A* for one mover and named flow maps that any
+ * number of movers heading for the same goals share, over the solid
+ * map layer (see pathfind.c) */
+
+#include "pathfind.h"
+#include "prentice.h"
+
+// goal lists up to this long are kept on the stack
+#define PATH_STACK_STEPS 256
+
+struct flowmap {
+    int lvl;
+    int *dist; // map_size_x * map_size_y, as pathfind_flow fills in
+};
+
+static struct pathfind *path_work(struct game *game);
+static int pr_flowmap(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_flowstep(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_mapsolid(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_path(ClientData clientData, Tcl_Interp *interp, int objc,
+                   Tcl_Obj *CONST objv[]);
+
+void path_commands(struct game *game) {
+    // name to struct flowmap
+    Tcl_InitHashTable(&game->flowmaps, TCL_STRING_KEYS);
+    LINK_COMMAND(game, "flowmap", pr_flowmap);
+    LINK_COMMAND(game, "flowstep", pr_flowstep);
+    LINK_COMMAND(game, "mapsolid", pr_mapsolid);
+    LINK_COMMAND(game, "path", pr_path);
+}
+
+void path_free(struct game *game) {
+    Tcl_HashSearch search;
+    Tcl_HashEntry *entry = Tcl_FirstHashEntry(&game->flowmaps, &search);
+    for (; entry != NULL; entry = Tcl_NextHashEntry(&search)) {
+        struct flowmap *flow = Tcl_GetHashValue(entry);
+        free(flow->dist);
+        free(flow);
+    }
+    Tcl_DeleteHashTable(&game->flowmaps);
+    if (game->pathfind) pathfind_free(game->pathfind);
+}
+
+// the working memory, sized once the map is
+inline static struct pathfind *path_work(struct game *game) {
+    if (game->pathfind == NULL)
+        game->pathfind = pathfind_new(game->map_size_x, game->map_size_y);
+    return game->pathfind;
+}
+
+// name w {x y ...} - (re)makes the named flow map out from the goals
+static int pr_flowmap(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, isnew;
+    Tcl_Obj **list;
+    assert(objc == 4);
+    assert(game->map_solid != NULL);
+    Tcl_GetIntFromObj(interp, objv[2], &lvl);
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    Tcl_ListObjGetElements(interp, objv[3], &count, &list);
+    assert((count & 1) == 0);
+
+    Tcl_HashEntry *entry =
+        Tcl_CreateHashEntry(&game->flowmaps, Tcl_GetString(objv[1]), &isnew);
+    struct flowmap *flow;
+    if (isnew) {
+        if ((flow = malloc(sizeof(struct flowmap))) == NULL) oom();
+        if ((flow->dist = malloc(sizeof(int) * game->map_size_x *
+                                 game->map_size_y)) == NULL)
+            oom();
+        Tcl_SetHashValue(entry, flow);
+    } else {
+        flow = Tcl_GetHashValue(entry);
+    }
+    flow->lvl = lvl;
+
+    int stackv[2 * PATH_STACK_STEPS], *goals = stackv;
+    if (count > 2 * PATH_STACK_STEPS)
+        goals = (int *) ckalloc(sizeof(int) * count);
+    for (int i = 0; i < count; i++)
+        Tcl_GetIntFromObj(interp, list[i], &goals[i]);
+    pathfind_flow(path_work(game), game->map_solid[lvl], count / 2, goals,
+                  flow->dist);
+    if (goals != stackv) ckfree((char *) goals);
+    return TCL_OK;
+}
+
+// name w x y - the dx dy of the move from x,y towards the goals of the
+// named flow map and the distance left after it, or an empty list if no
+// move gets any closer
+static int pr_flowstep(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int lvl, x, y, dx, dy;
+    assert(objc == 5);
+    Tcl_GetIntFromObj(interp, objv[2], &lvl);
+    Tcl_GetIntFromObj(interp, objv[3], &x);
+    Tcl_GetIntFromObj(interp, objv[4], &y);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    Tcl_HashEntry *entry =
+        Tcl_FindHashEntry(&game->flowmaps, Tcl_GetString(objv[1]));
+    if (entry == NULL) return TCL_OK;
+    struct flowmap *flow = Tcl_GetHashValue(entry);
+    if (flow->lvl != lvl) return TCL_OK;
+    int dist = pathfind_step(game->map_solid[lvl], flow->dist,
+                             game->map_size_x, game->map_size_y, x, y, &dx,
+                             &dy);
+    if (dist == PATH_UNREACHABLE) return TCL_OK;
+    Tcl_Obj *step[3] = {Tcl_NewIntObj(dx), Tcl_NewIntObj(dy),
+                        Tcl_NewIntObj(dist)};
+    Tcl_SetObjResult(interp, Tcl_NewListObj(3, step));
+    return TCL_OK;
+}
+
+// w x y is-solid? - for when a solid entity enters or leaves a cell
+static int pr_mapsolid(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int lvl, x, y, solid;
+    assert(objc == 5);
+    if (game->map_solid == NULL) return TCL_OK; // initmap not yet called
+    Tcl_GetIntFromObj(interp, objv[1], &lvl);
+    Tcl_GetIntFromObj(interp, objv[2], &x);
+    Tcl_GetIntFromObj(interp, objv[3], &y);
+    Tcl_GetBooleanFromObj(interp, objv[4], &solid);
+    assert(lvl >= 0 && lvl < game->map_size_w);
+    assert(x >= 0 && x < game->map_size_x);
+    assert(y >= 0 && y < game->map_size_y);
+    game->map_solid[lvl][x][y] = solid;
+    return TCL_OK;
+}
+
+// w,x,y x y - the cells of a shortest path from w,x,y to x,y as a list
+// of x y pairs (empty if there is none). the goal may be solid
+static int pr_path(ClientData clientData, Tcl_Interp *interp, int objc,
+                   Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    int count, lvl, sx, sy, gx, gy;
+    Tcl_Obj **list;
+    assert(objc == 4);
+    assert(game->map_solid != NULL);
+    Tcl_ListObjGetElements(interp, objv[1], &count, &list);
+    assert(count == 3);
+    Tcl_GetIntFromObj(interp, list[0], &lvl);
+    Tcl_GetIntFromObj(interp, list[1], &sx);
+    Tcl_GetIntFromObj(interp, list[2], &sy);
+    Tcl_GetIntFromObj(interp, objv[2], &gx);
+    Tcl_GetIntFromObj(interp, objv[3], &gy);
+    assert(lvl >= 0 && lvl < game->map_size_w);
+
+    // no path is longer than the map has cells
+    struct pathfind *pf = path_work(game);
+    int *steps = pathfind_steps(pf);
+    int len = pathfind_astar(pf, game->map_solid[lvl], sx, sy, gx, gy, steps,
+                             game->map_size_x * game->map_size_y);
+    Tcl_Obj *path = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < 2 * len; i++)
+        Tcl_ListObjAppendElement(interp, path, Tcl_NewIntObj(steps[i]));
+    Tcl_SetObjResult(interp, path);
+    return TCL_OK;
+}
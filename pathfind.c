@@ -0,0 +1,197 @@
+/* pathfinding - A* with a binary heap for one mover and breadth first
+ * flow maps (Dijkstra, as every move costs the same) for many. the
+ * working arrays are made once per map size; a generation count marks
+ * what the current search has touched so nothing is cleared between
+ * searches */
+
+#include "pathfind.h"
+#include "prentice.h"
+
+struct node {
+    int rank;  // cost so far plus the heuristic
+    int guess; // the heuristic, to break ties towards the goal
+    int cell;
+};
+
+struct pathfind {
+    int size_x, size_y;
+    uint32_t generation;
+    uint32_t *seen, *closed; // generation a cell was reached or finished
+    int *cost, *parent;
+    int *queue;        // of the flow map fill
+    int *steps;        // (x, y) pairs, room for a path through every cell
+    struct node *heap; // open cells of A*, with stale duplicates
+    int heap_len, heap_size;
+};
+
+// orthogonal moves first so that ties go straight
+static const int Moves[8][2] = {{0, -1}, {1, 0},  {0, 1},   {-1, 0},
+                                {1, -1}, {1, 1}, {-1, 1}, {-1, -1}};
+
+static int chebyshev(int x1, int y1, int x2, int y2);
+static void heap_push(struct pathfind *pf, int rank, int guess, int cell);
+static struct node heap_pop(struct pathfind *pf);
+static int node_before(struct node *a, struct node *b);
+
+inline static int chebyshev(int x1, int y1, int x2, int y2) {
+    int dx = abs(x1 - x2), dy = abs(y1 - y2);
+    return dx > dy ? dx : dy;
+}
+
+static void heap_push(struct pathfind *pf, int rank, int guess, int cell) {
+    assert(pf->heap_len < pf->heap_size);
+    int i = pf->heap_len++;
+    struct node node = {rank, guess, cell};
+    while (i > 0) {
+        int up = (i - 1) / 2;
+        if (!node_before(&node, &pf->heap[up])) break;
+        pf->heap[i] = pf->heap[up];
+        i           = up;
+    }
+    pf->heap[i] = node;
+}
+
+static struct node heap_pop(struct pathfind *pf) {
+    struct node top  = pf->heap[0];
+    struct node last = pf->heap[--pf->heap_len];
+    int i = 0, len = pf->heap_len;
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= len) break;
+        if (child + 1 < len &&
+            node_before(&pf->heap[child + 1], &pf->heap[child]))
+            child++;
+        if (!node_before(&pf->heap[child], &last)) break;
+        pf->heap[i] = pf->heap[child];
+        i           = child;
+    }
+    if (len) pf->heap[i] = last;
+    return top;
+}
+
+inline static int node_before(struct node *a, struct node *b) {
+    return a->rank < b->rank || (a->rank == b->rank && a->guess < b->guess);
+}
+
+int pathfind_astar(struct pathfind *pf, int **blocked, int sx, int sy,
+                   int gx, int gy, int *steps, int max_steps) {
+    int size_x = pf->size_x, size_y = pf->size_y;
+    assert(sx >= 0 && sx < size_x && sy >= 0 && sy < size_y);
+    assert(gx >= 0 && gx < size_x && gy >= 0 && gy < size_y);
+    uint32_t gen = ++pf->generation;
+    int start = sx * size_y + sy, goal = gx * size_y + gy;
+    pf->heap_len      = 0;
+    pf->seen[start]   = gen;
+    pf->cost[start]   = 0;
+    pf->parent[start] = -1;
+    heap_push(pf, chebyshev(sx, sy, gx, gy), chebyshev(sx, sy, gx, gy),
+              start);
+    while (pf->heap_len) {
+        int cell = heap_pop(pf).cell;
+        // the heuristic is consistent so the first pop is the best
+        if (pf->closed[cell] == gen) continue;
+        pf->closed[cell] = gen;
+        if (cell == goal) break;
+        int x = cell / size_y, y = cell % size_y;
+        for (int i = 0; i < 8; i++) {
+            int nx = x + Moves[i][0], ny = y + Moves[i][1];
+            if (nx < 0 || nx >= size_x || ny < 0 || ny >= size_y) continue;
+            int next = nx * size_y + ny;
+            if (pf->closed[next] == gen) continue;
+            if (blocked[nx][ny] && next != goal) continue;
+            int cost = pf->cost[cell] + 1;
+            if (pf->seen[next] == gen && pf->cost[next] <= cost) continue;
+            pf->seen[next]   = gen;
+            pf->cost[next]   = cost;
+            pf->parent[next] = cell;
+            int guess        = chebyshev(nx, ny, gx, gy);
+            heap_push(pf, cost + guess, guess, next);
+        }
+    }
+    if (pf->closed[goal] != gen) return -1;
+    int len = pf->cost[goal];
+    for (int cell = goal, i = len - 1; i >= 0; cell = pf->parent[cell], i--) {
+        if (i >= max_steps) continue;
+        steps[2 * i]     = cell / size_y;
+        steps[2 * i + 1] = cell % size_y;
+    }
+    return len;
+}
+
+void pathfind_flow(struct pathfind *pf, int **blocked, int count,
+                   const int *goals, int *flow) {
+    int size_x = pf->size_x, size_y = pf->size_y;
+    int head = 0, tail = 0;
+    for (int i = 0; i < size_x * size_y; i++)
+        flow[i] = PATH_UNREACHABLE;
+    for (int i = 0; i < count; i++) {
+        int x = goals[2 * i], y = goals[2 * i + 1];
+        if (x < 0 || x >= size_x || y < 0 || y >= size_y) continue;
+        int cell = x * size_y + y;
+        if (flow[cell] == 0) continue;
+        flow[cell]       = 0;
+        pf->queue[tail++] = cell;
+    }
+    while (head < tail) {
+        int cell = pf->queue[head++];
+        int x = cell / size_y, y = cell % size_y;
+        for (int i = 0; i < 8; i++) {
+            int nx = x + Moves[i][0], ny = y + Moves[i][1];
+            if (nx < 0 || nx >= size_x || ny < 0 || ny >= size_y) continue;
+            int next = nx * size_y + ny;
+            if (flow[next] != PATH_UNREACHABLE || blocked[nx][ny]) continue;
+            flow[next]        = flow[cell] + 1;
+            pf->queue[tail++] = next;
+        }
+    }
+}
+
+void pathfind_free(struct pathfind *pf) {
+    free(pf->seen);
+    free(pf->closed);
+    free(pf->cost);
+    free(pf->parent);
+    free(pf->queue);
+    free(pf->heap);
+    free(pf->steps);
+    free(pf);
+}
+
+struct pathfind *pathfind_new(int size_x, int size_y) {
+    struct pathfind *pf;
+    size_t cells = (size_t) size_x * size_y;
+    if ((pf = calloc(1, sizeof(struct pathfind))) == NULL) oom();
+    pf->size_x = size_x;
+    pf->size_y = size_y;
+    // each cell can be pushed once per neighbour that improves on it
+    pf->heap_size = 8 * cells + 1;
+    if ((pf->seen = calloc(cells, sizeof(uint32_t))) == NULL ||
+        (pf->closed = calloc(cells, sizeof(uint32_t))) == NULL ||
+        (pf->cost = malloc(cells * sizeof(int))) == NULL ||
+        (pf->parent = malloc(cells * sizeof(int))) == NULL ||
+        (pf->queue = malloc(cells * sizeof(int))) == NULL ||
+        (pf->heap = malloc(pf->heap_size * sizeof(struct node))) == NULL ||
+        (pf->steps = malloc(2 * cells * sizeof(int))) == NULL)
+        oom();
+    return pf;
+}
+
+int pathfind_step(int **blocked, const int *flow, int size_x, int size_y,
+                  int x, int y, int *dx, int *dy) {
+    int best = flow[x * size_y + y];
+    int moved = 0;
+    for (int i = 0; i < 8; i++) {
+        int nx = x + Moves[i][0], ny = y + Moves[i][1];
+        if (nx < 0 || nx >= size_x || ny < 0 || ny >= size_y) continue;
+        int dist = flow[nx * size_y + ny];
+        // a goal may well be blocked (by who is being chased)
+        if (dist >= best || (dist > 0 && blocked[nx][ny])) continue;
+        best  = dist;
+        moved = 1;
+        *dx   = Moves[i][0];
+        *dy   = Moves[i][1];
+    }
+    return moved ? best : PATH_UNREACHABLE;
+}
+
+int *pathfind_steps(struct pathfind *pf) { return pf->steps; }
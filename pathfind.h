@@ -0,0 +1,44 @@
+#ifndef _H_PATHFIND_H_
+#define _H_PATHFIND_H_
+
+/* pathfinding over a grid with 8-way moves that each cost 1, as the
+ * keymoves table allows, so distances are Chebyshev
+ *
+ * blocked must be a 2-dimension array of size (size_x, size_y) that is
+ * non-zero where a mover cannot go. cells are numbered x * size_y + y
+ * for the flow maps, the same layout the map layers have */
+
+#include <limits.h>
+
+#define PATH_UNREACHABLE INT_MAX
+
+struct pathfind; // working memory for one map size, reused by each search
+
+void pathfind_free(struct pathfind *pf);
+struct pathfind *pathfind_new(int size_x, int size_y);
+
+/* room for size_x * size_y (x, y) pairs, enough for any path that
+ * pathfind_astar finds, so callers need not allocate per search */
+int *pathfind_steps(struct pathfind *pf);
+
+/* A* from (sx, sy) to (gx, gy); the goal need not be open (it may be
+ * who is being chased). up to max_steps (x, y) pairs of the path, not
+ * counting the start, are written to steps. returns the length of the
+ * path or -1 if there is none */
+int pathfind_astar(struct pathfind *pf, int **blocked, int sx, int sy,
+                   int gx, int gy, int *steps, int max_steps);
+
+/* flow map out from count (x, y) goals: flow[cell] is set to the
+ * distance to the nearest goal or PATH_UNREACHABLE. every mover headed
+ * for the same goals can share the one map */
+void pathfind_flow(struct pathfind *pf, int **blocked, int count,
+                   const int *goals, int *flow);
+
+/* the move from (x, y) that gets closest to a goal of the flow map,
+ * skipping cells that have become blocked since the map was made.
+ * returns the distance left after the move or PATH_UNREACHABLE if no
+ * move gets any closer */
+int pathfind_step(int **blocked, const int *flow, int size_x, int size_y,
+                  int x, int y, int *dx, int *dy);
+
+#endif
@@ -9,11 +9,13 @@
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sysexits.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <ncurses.h>
@@ -37,28 +39,166 @@
 #define VIEW_OFFSET_X VIEW_SIZE_X / 2
 #define VIEW_OFFSET_Y VIEW_SIZE_Y / 2
 
+// log severity levels
+enum { LOG_DEBUG, LOG_INFO, LOG_WARN, LOG_ERROR };
+
+// fixed timing histogram slots for the C side timers
+enum { TIME_FOV, TIME_DRAWMAP, TIME_DOUPDATE, TIME_GETCH, TIME_LIGHT };
+
+#ifndef TIMING_FILE
+#define TIMING_FILE "timing.json"
+#endif
+
 #ifndef oom
 #define oom() fatal("out of memory: %s\n", strerror(errno))
 #endif
 
-extern Tcl_Interp *Interp;
+struct cell;     // cells.c
+struct events;   // events.c
+struct keys;     // keys.c
+struct messages; // message.c
+struct stats;    // stats.c
+
+// everything one game needs; this is the ClientData of the commands
+// linked to its interpreter, so many games can run in one process
+struct game {
+    Tcl_Interp *interp;
+    Tcl_WideInt turn; // linked to the TCL turn variable
+    int hosted;       // one of many (see host.c); no screen, not timed
+    char ***map_chars; // the top of each cell stack
+    struct cell **map_cells;
+    struct events *events;
+    int ***map_light, ***map_seen, ***map_solid, ***map_walls;
+    int map_size_w, map_size_x, map_size_y;
+    Tcl_HashTable fov_cache;
+    Tcl_HashTable lights; // see light.c
+    struct keys *keys;
+    Tcl_HashTable flowmaps;    // see path.c
+    struct pathfind *pathfind; // made on first use
+    struct messages *messages;
+    struct stats *stats;
+};
+
+extern struct game *Game; // the one on the screen
 
 // bind a TCL command name to a C fn
-#define LINK_COMMAND(name, fn)                                                 \
-    if (Tcl_CreateObjCommand(Interp, name, fn, (ClientData) NULL,              \
+#define LINK_COMMAND(game, name, fn)                                           \
+    if (Tcl_CreateObjCommand((game)->interp, name, fn, (ClientData) (game),    \
                              (Tcl_CmdDeleteProc *) NULL) == NULL)              \
     errx(1, "Tcl_CreateObjCommand failed")
 
+// autosave.c
+void autosave_commands(struct game *game);
+
+// cells.c
+void cells_commands(struct game *game);
+Tcl_Obj *cells_entids(struct game *game, int lvl, int x, int y);
+void cells_free(struct game *game);
+
+// events.c
+void events_commands(struct game *game);
+void events_free(struct game *game);
+void events_moved(struct game *game, Tcl_WideInt entid, int oldw, int oldx,
+                  int oldy, int neww, int newx, int newy);
+
+// fov.c
+void fov_commands(struct game *game);
+int **fov_for(struct game *game, Tcl_WideInt entid, int lvl, int x, int y,
+              int radius);
+void fov_forget(struct game *game, Tcl_WideInt entid);
+void fov_free(struct game *game);
+void fov_wall(struct game *game, int lvl, int x, int y, int wall);
+
+// game.c
+void game_free(struct game *game);
+int game_init(struct game *game, const char *dbfile, int savedb,
+              int autosave, int warmup);
+struct game *game_new(int hosted);
+
+// host.c
+void host_run(const char *script, int count, int threads);
+
 // jsf.c
-void setup_jsf(void);
+uint32_t setup_jsf(void);
+
+// keys.c
+void keys_commands(struct game *game);
+void keys_free(struct game *game);
+
+// light.c
+void light_commands(struct game *game);
+void light_free(struct game *game);
+void light_moved(struct game *game, Tcl_WideInt entid, int neww, int newx,
+                 int newy);
+void light_wall(struct game *game, int lvl, int x, int y);
+
+// log.c
+size_t json_escape(char *buf, const char *s, size_t len);
+void json_fputs(const char *s, FILE *fh);
+void log_commands(struct game *game);
+void log_flush(void);
+int log_level(const char *name);
+void log_msg(int level, const char *fmt, ...);
+void setup_log(int level);
 
 // main.c
 void fatal(const char *const fmt, ...);
 
 // map.c
+void map_commands(struct game *game);
+void map_free(struct game *game);
 void setup_map(void);
 
 // messages.c
+int draw_messages(void);
+void message_commands(struct game *game);
+void message_free(struct game *game);
+int message_nth(struct game *game, int n, const char **text,
+                Tcl_WideInt *turn, int *count);
 void setup_messages(void);
 
+// path.c
+void path_commands(struct game *game);
+void path_free(struct game *game);
+
+// profile.c
+void profile_commands(struct game *game);
+void profile_dump(const char *file);
+void profile_start(struct game *game, const char *file);
+
+// replay.c
+void record_key(int ch);
+void record_open(const char *file, uint32_t seed);
+int replay_key(void);
+uint32_t replay_open(const char *file);
+void replay_start(void);
+int replaying(void);
+
+// snapshot.c
+void snapshot_open(const char *file);
+void snapshot_publish(int lvl, int x, int y);
+
+// spectate.c
+void spectate_open(const char *path);
+void spectate_pump(void);
+FILE *spectate_screen(int tty);
+void spectate_tty(void);
+void spectate_wait(void);
+
+// stats.c
+void stats_commands(struct game *game);
+void stats_free(struct game *game);
+
+// timing.c
+int name_intern(const char *name);
+const char *name_text(int id);
+void setup_timing(void);
+void timing_commands(struct game *game);
+void timing_add(int id, uint64_t start);
+void timing_dump(const char *file);
+int timing_id(const char *name);
+uint64_t timing_now(void);
+void timing_poll(void);
+void timing_record(int id, uint64_t nsec);
+
 #endif
@@ -0,0 +1,453 @@
+/* profiler (-P) - self and total time of each TCL proc, SQL statement,
+ * and wrapped command of the game on the screen, written at exit as
+ * folded stacks (for flamegraph.pl and the like) with a JSON summary.
+ *
+ * procs are wrapped as they are defined: proc makes the real one under
+ * name-unprofiled and a C command that times the call takes the name.
+ * the wrapper adds no call frame so upvar and uplevel are unchanged.
+ * tailcall is wrapped too so a tail called proc takes the place of its
+ * caller on the profile stack, and use_energy does not nest forever */
+
+#include "prentice.h"
+
+// what a wrapper stands in for
+struct pcmd {
+    Tcl_Obj *real; // name-unprofiled
+    int name;
+    int sqlite; // eval, exists, and onecolumn are named by their SQL
+};
+
+// by name id (see name_intern)
+struct pname {
+    uint64_t calls, self, total;
+    int active; // calls in progress, so recursion is only totalled once
+};
+
+// the call tree; node 0 is the root. a proc mostly calls the same
+// thing as the last time, so that child is kept at hand
+struct pnode {
+    int parent, name, last_name, last_child;
+    uint64_t self;
+};
+
+struct pframe {
+    int node, name, isproc;
+    uint64_t start, child;
+};
+
+// only the game on the screen is profiled, so no locks
+static char *Profile_File;
+static Tcl_HashTable Node_Ids, Procs;
+static struct pname *Names;
+static struct pnode *Nodes;
+static struct pframe *Stack;
+static int Name_Count, Name_Size, Node_Count, Node_Size, Depth, Stack_Size;
+static Tcl_Obj *Proc_Real;
+
+// names of recently run SQL by the Tcl_Obj (mostly a literal in some
+// proc) it was in; the reference held keeps the address from being
+// reused while it is here
+#define SQL_CACHE 256
+static struct {
+    Tcl_Obj *sql;
+    int name;
+} Sql_Cache[SQL_CACHE];
+
+static void dump_folded(FILE *fh, int node);
+static int name_id(const char *name);
+static int node_id(int parent, int name);
+static int nr_profile_proc(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]);
+static int nr_profile_tailcall(ClientData clientData, Tcl_Interp *interp,
+                               int objc, Tcl_Obj *CONST objv[]);
+static struct pcmd *pcmd_new(const char *name, int sqlite);
+static void pop_to(int depth, uint64_t now);
+static void profile_atexit(void);
+static int profile_done(ClientData data[], Tcl_Interp *interp, int result);
+static int profile_leave(ClientData data[], Tcl_Interp *interp, int result);
+static struct pcmd *profile_rename(Tcl_Interp *interp, const char *name,
+                                   int sqlite);
+static int pr_profile_cmd(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_defproc(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_dump(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_nop(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_proc(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_tailcall(ClientData clientData, Tcl_Interp *interp,
+                               int objc, Tcl_Obj *CONST objv[]);
+static int pr_profile_wrap(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]);
+static void push(int name, int isproc, uint64_t start);
+static int sql_name(Tcl_Obj *sql);
+
+// the path to each node with self time; ; separates the frames so is
+// swapped out of any name (SQL, mostly)
+static void dump_folded(FILE *fh, int node) {
+    int path[256], len = 0;
+    for (int n = node; n && len < 256; n = Nodes[n].parent)
+        path[len++] = n;
+    for (int i = len - 1; i >= 0; i--) {
+        for (const char *s = name_text(Nodes[path[i]].name); *s; s++)
+            fputc(*s == ';' ? ',' : *s, fh);
+        fputc(i ? ';' : ' ', fh);
+    }
+    fprintf(fh, "%llu\n", (unsigned long long) Nodes[node].self);
+}
+
+// the shared name id, with room made for its counts
+static int name_id(const char *name) {
+    int id = name_intern(name);
+    if (id >= Name_Size) {
+        int size = Name_Size ? Name_Size : 256;
+        while (size <= id)
+            size *= 2;
+        if ((Names = realloc(Names, sizeof(struct pname) * size)) == NULL)
+            oom();
+        memset(Names + Name_Size, 0,
+               sizeof(struct pname) * (size - Name_Size));
+        Name_Size = size;
+    }
+    if (id >= Name_Count) Name_Count = id + 1;
+    return id;
+}
+
+static int node_id(int parent, int name) {
+    if (Nodes[parent].last_name == name) return Nodes[parent].last_child;
+    int isnew, key[2] = {parent, name};
+    Tcl_HashEntry *entry =
+        Tcl_CreateHashEntry(&Node_Ids, (const char *) key, &isnew);
+    Nodes[parent].last_name = name;
+    if (!isnew)
+        return Nodes[parent].last_child =
+                   (int) (intptr_t) Tcl_GetHashValue(entry);
+    if (Node_Count == Node_Size) {
+        Node_Size *= 2;
+        if ((Nodes = realloc(Nodes, sizeof(struct pnode) * Node_Size)) ==
+            NULL)
+            oom();
+    }
+    Nodes[Node_Count].parent    = parent;
+    Nodes[Node_Count].name      = name;
+    Nodes[Node_Count].last_name = -1;
+    Nodes[Node_Count].self      = 0;
+    Tcl_SetHashValue(entry, (ClientData) (intptr_t) Node_Count);
+    return Nodes[parent].last_child = Node_Count++;
+}
+
+// runs the real proc; profile_leave ends whatever is then in its place
+// on the stack (itself, or what it tail called)
+static int nr_profile_proc(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]) {
+    struct pcmd *cmd = clientData;
+    Tcl_Obj **argv   = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * objc);
+    argv[0]          = cmd->real;
+    for (int i = 1; i < objc; i++)
+        argv[i] = objv[i];
+    Tcl_NRAddCallback(interp, profile_leave, (ClientData) (intptr_t) Depth,
+                      argv, NULL, NULL);
+    push(cmd->name, 1, 0);
+    return Tcl_NREvalObjv(interp, objc, argv, 0);
+}
+
+// the calling proc (and any SQL it is in the middle of) ends here, and
+// the tail called command starts in its place. a wrapped proc is tail
+// called directly so no new profile_leave piles up under it
+static int nr_profile_tailcall(ClientData clientData, Tcl_Interp *interp,
+                               int objc, Tcl_Obj *CONST objv[]) {
+    struct pcmd *cmd = clientData;
+    Tcl_Obj **argv   = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * objc);
+    argv[0]          = cmd->real;
+    for (int i = 1; i < objc; i++)
+        argv[i] = objv[i];
+    int top = Depth - 1;
+    while (top >= 0 && !Stack[top].isproc)
+        top--;
+    if (objc > 1 && top >= 0) {
+        uint64_t now = timing_now();
+        pop_to(top, now);
+        Tcl_HashEntry *entry =
+            Tcl_FindHashEntry(&Procs, Tcl_GetString(objv[1]));
+        if (entry != NULL) {
+            struct pcmd *target = Tcl_GetHashValue(entry);
+            argv[1]             = target->real;
+            push(target->name, 1, now);
+        } else {
+            push(name_id(Tcl_GetString(objv[1])), 1, now);
+        }
+    }
+    Tcl_NRAddCallback(interp, profile_done, argv, NULL, NULL, NULL);
+    return Tcl_NREvalObjv(interp, objc, argv, 0);
+}
+
+static void pop_to(int depth, uint64_t now) {
+    while (Depth > depth) {
+        struct pframe *f = &Stack[--Depth];
+        uint64_t total   = now - f->start;
+        uint64_t self    = total - f->child;
+        Nodes[f->node].self += self;
+        struct pname *p = &Names[f->name];
+        p->self += self;
+        if (--p->active == 0) p->total += total;
+        if (Depth) Stack[Depth - 1].child += total;
+    }
+}
+
+// whatever was still running (use_energy, and so forth) ends at exit
+static void profile_atexit(void) {
+    pop_to(0, timing_now());
+    profile_dump(Profile_File);
+}
+
+static int profile_done(ClientData data[], Tcl_Interp *interp, int result) {
+    ckfree((char *) data[0]);
+    return result;
+}
+
+static int profile_leave(ClientData data[], Tcl_Interp *interp, int result) {
+    pop_to((int) (intptr_t) data[0], timing_now());
+    ckfree((char *) data[1]);
+    return result;
+}
+
+// the wrapper data for name, which calls name-unprofiled
+static struct pcmd *pcmd_new(const char *name, int sqlite) {
+    struct pcmd *cmd;
+    if ((cmd = malloc(sizeof(struct pcmd))) == NULL) oom();
+    cmd->real   = Tcl_ObjPrintf("%s-unprofiled", name);
+    cmd->name   = name_id(name);
+    cmd->sqlite = sqlite;
+    Tcl_IncrRefCount(cmd->real);
+    return cmd;
+}
+
+// renames name to name-unprofiled for the wrapper to call
+static struct pcmd *profile_rename(Tcl_Interp *interp, const char *name,
+                                   int sqlite) {
+    struct pcmd *cmd = pcmd_new(name, sqlite);
+    Tcl_Obj *rename  = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(rename);
+    Tcl_ListObjAppendElement(NULL, rename, Tcl_NewStringObj("rename", -1));
+    Tcl_ListObjAppendElement(NULL, rename, Tcl_NewStringObj(name, -1));
+    Tcl_ListObjAppendElement(NULL, rename, cmd->real);
+    if (Tcl_EvalObjEx(interp, rename, TCL_EVAL_GLOBAL) != TCL_OK)
+        errx(1, "rename %s failed: %s", name, Tcl_GetStringResult(interp));
+    Tcl_DecrRefCount(rename);
+    return cmd;
+}
+
+// a C command (or sqlite database) gets a frame of its own
+static int pr_profile_cmd(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]) {
+    struct pcmd *cmd = clientData;
+    Tcl_Obj *stackv[8], **argv = stackv;
+    if (objc > 8) argv = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * objc);
+    argv[0] = cmd->real;
+    for (int i = 1; i < objc; i++)
+        argv[i] = objv[i];
+    int name = cmd->name;
+    if (cmd->sqlite && objc > 1) {
+        const char *sub = Tcl_GetString(objv[1]);
+        if (objc > 2 && (strcmp(sub, "eval") == 0 ||
+                         strcmp(sub, "exists") == 0 ||
+                         strcmp(sub, "onecolumn") == 0)) {
+            name = sql_name(objv[2]);
+        } else {
+            // ecs transaction and the like
+            char method[64];
+            snprintf(method, sizeof(method), "%s %s",
+                     name_text(cmd->name), sub);
+            name = name_id(method);
+        }
+    }
+    int depth = Depth;
+    push(name, 0, 0);
+    int ret = Tcl_EvalObjv(interp, objc, argv, 0);
+    // unless a tailcall in an eval script has already ended it
+    pop_to(depth, timing_now());
+    if (argv != stackv) ckfree((char *) argv);
+    return ret;
+}
+
+// proc name args body - namespaced procs are left unprofiled
+static int pr_profile_defproc(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_Obj *argv[4];
+    int isnew;
+    if (objc != 4 || strstr(Tcl_GetString(objv[1]), "::") != NULL ||
+        Tcl_GetCurrentNamespace(interp) != Tcl_GetGlobalNamespace(interp)) {
+        Tcl_Obj *stackv[8], **args = stackv;
+        if (objc > 8) args = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * objc);
+        args[0] = Proc_Real;
+        for (int i = 1; i < objc; i++)
+            args[i] = objv[i];
+        int ret = Tcl_EvalObjv(interp, objc, args, 0);
+        if (args != stackv) ckfree((char *) args);
+        return ret;
+    }
+    const char *name = Tcl_GetString(objv[1]);
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&Procs, name, &isnew);
+    struct pcmd *cmd;
+    if (isnew)
+        Tcl_SetHashValue(entry, cmd = pcmd_new(name, 0));
+    else
+        cmd = Tcl_GetHashValue(entry);
+    argv[0] = Proc_Real;
+    argv[1] = cmd->real;
+    argv[2] = objv[2];
+    argv[3] = objv[3];
+    int ret = Tcl_EvalObjv(interp, 4, argv, 0);
+    if (ret != TCL_OK) return ret;
+    if (Tcl_NRCreateCommand(interp, name, pr_profile_proc, nr_profile_proc,
+                            cmd, (Tcl_CmdDeleteProc *) NULL) == NULL)
+        errx(1, "Tcl_NRCreateCommand failed");
+    return TCL_OK;
+}
+
+static int pr_profile_dump(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 1 || objc == 2);
+    profile_dump(objc == 2 ? Tcl_GetString(objv[1]) : Profile_File);
+    return TCL_OK;
+}
+
+// when not profiling, and for hosted games
+static int pr_profile_nop(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]) {
+    return TCL_OK;
+}
+
+static int pr_profile_proc(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]) {
+    return Tcl_NRCallObjProc(interp, nr_profile_proc, clientData, objc,
+                             objv);
+}
+
+static int pr_profile_tailcall(ClientData clientData, Tcl_Interp *interp,
+                               int objc, Tcl_Obj *CONST objv[]) {
+    return Tcl_NRCallObjProc(interp, nr_profile_tailcall, clientData, objc,
+                             objv);
+}
+
+// renames the given (sqlite database) command to name-unprofiled and
+// puts a profiling wrapper in its place
+static int pr_profile_wrap(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 2);
+    const char *name = Tcl_GetString(objv[1]);
+    struct pcmd *cmd = profile_rename(interp, name, 1);
+    if (Tcl_CreateObjCommand(interp, name, pr_profile_cmd, cmd,
+                             (Tcl_CmdDeleteProc *) NULL) == NULL)
+        errx(1, "Tcl_CreateObjCommand failed");
+    return TCL_OK;
+}
+
+void profile_commands(struct game *game) {
+    if (game->hosted || Profile_File == NULL) {
+        LINK_COMMAND(game, "profile_dump", pr_profile_nop);
+        LINK_COMMAND(game, "profile_wrap", pr_profile_nop);
+        return;
+    }
+    LINK_COMMAND(game, "profile_dump", pr_profile_dump);
+    LINK_COMMAND(game, "profile_wrap", pr_profile_wrap);
+}
+
+void profile_dump(const char *file) {
+    FILE *fh;
+    if ((fh = fopen(file, "w")) == NULL) {
+        log_msg(LOG_WARN, "could not write %s: %s", file, strerror(errno));
+        return;
+    }
+    for (int i = 1; i < Node_Count; i++)
+        if (Nodes[i].self) dump_folded(fh, i);
+    fclose(fh);
+
+    char *json;
+    if ((json = malloc(strlen(file) + 6)) == NULL) oom();
+    sprintf(json, "%s.json", file);
+    if ((fh = fopen(json, "w")) == NULL) {
+        log_msg(LOG_WARN, "could not write %s: %s", json, strerror(errno));
+        free(json);
+        return;
+    }
+    free(json);
+    fputs("{\"unit\":\"ns\",\"names\":[", fh);
+    int first = 1;
+    for (int i = 0; i < Name_Count; i++) {
+        struct pname *p = &Names[i];
+        if (!p->calls) continue;
+        fputs(first ? "{\"name\":\"" : ",{\"name\":\"", fh);
+        json_fputs(name_text(i), fh);
+        fprintf(fh, "\",\"calls\":%llu,\"total\":%llu,\"self\":%llu}",
+                (unsigned long long) p->calls, (unsigned long long) p->total,
+                (unsigned long long) p->self);
+        first = 0;
+    }
+    fputs("]}\n", fh);
+    fclose(fh);
+}
+
+// turns the profiler on for the given game (before game_init, so that
+// all of init.tcl is seen) and has it write to file at exit
+void profile_start(struct game *game, const char *file) {
+    Tcl_Interp *interp = game->interp;
+    assert(!game->hosted);
+    if ((Profile_File = strdup(file)) == NULL) oom();
+    Tcl_InitHashTable(&Node_Ids, 2);
+    Tcl_InitHashTable(&Procs, TCL_STRING_KEYS);
+    Node_Size = 256;
+    if ((Nodes = malloc(sizeof(struct pnode) * Node_Size)) == NULL) oom();
+    Nodes[0].parent = Nodes[0].name = Nodes[0].last_name = -1;
+    Nodes[0].self                                       = 0;
+    Node_Count                                          = 1;
+
+    Proc_Real = profile_rename(interp, "proc", 0)->real;
+    struct pcmd *cmd = profile_rename(interp, "tailcall", 0);
+    if (Tcl_CreateObjCommand(interp, "proc", pr_profile_defproc, NULL,
+                             (Tcl_CmdDeleteProc *) NULL) == NULL ||
+        Tcl_NRCreateCommand(interp, "tailcall", pr_profile_tailcall,
+                            nr_profile_tailcall, cmd,
+                            (Tcl_CmdDeleteProc *) NULL) == NULL)
+        errx(1, "Tcl_CreateObjCommand failed");
+    // waiting on the player is not the game being slow
+    cmd = profile_rename(interp, "getch", 0);
+    if (Tcl_CreateObjCommand(interp, "getch", pr_profile_cmd, cmd,
+                             (Tcl_CmdDeleteProc *) NULL) == NULL)
+        errx(1, "Tcl_CreateObjCommand failed");
+    // game_new linked the no-op commands before there was a file
+    profile_commands(game);
+    atexit(profile_atexit);
+}
+
+// the start time is that given, or else now
+static void push(int name, int isproc, uint64_t start) {
+    if (Depth == Stack_Size) {
+        Stack_Size = Stack_Size ? Stack_Size * 2 : 64;
+        if ((Stack = realloc(Stack, sizeof(struct pframe) * Stack_Size)) ==
+            NULL)
+            oom();
+    }
+    struct pframe *f = &Stack[Depth];
+    f->node          = node_id(Depth ? Stack[Depth - 1].node : 0, name);
+    f->name          = name;
+    f->isproc        = isproc;
+    f->child         = 0;
+    Names[name].calls++;
+    Names[name].active++;
+    Depth++;
+    f->start = start ? start : timing_now();
+}
+
+inline static int sql_name(Tcl_Obj *sql) {
+    int i = (int) (((uintptr_t) sql >> 4) & (SQL_CACHE - 1));
+    if (Sql_Cache[i].sql != sql) {
+        if (Sql_Cache[i].sql) Tcl_DecrRefCount(Sql_Cache[i].sql);
+        Sql_Cache[i].sql = sql;
+        Tcl_IncrRefCount(sql);
+        Sql_Cache[i].name = name_id(Tcl_GetString(sql));
+    }
+    return Sql_Cache[i].name;
+}
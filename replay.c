@@ -0,0 +1,109 @@
+/* input recording and replay - the RNG seed and every key read by getch
+ * (with the turn it was read on) go to a file that can later be fed
+ * back in without a terminal to reproduce a game and time it
+ *
+ * file format: "PRR" version-byte seed (4 bytes, little endian) then
+ * for each key the turns since the previous key and the key, both as
+ * LEB128 varints */
+
+#include "prentice.h"
+
+#define REPLAY_MAGIC "PRR"
+#define REPLAY_VERSION 1
+
+static FILE *Record_Fh, *Replay_Fh;
+static Tcl_WideInt Record_Turn, Replay_Turn;
+static long Replay_Keys;
+static uint64_t Replay_Start;
+
+static uint32_t read_header(FILE *fh, const char *file);
+static int read_varint(FILE *fh, uint64_t *value);
+static void replay_exit(ClientData clientData);
+static void write_varint(FILE *fh, uint64_t value);
+
+static uint32_t read_header(FILE *fh, const char *file) {
+    unsigned char header[8];
+    if (fread(header, sizeof(header), 1, fh) != 1 ||
+        memcmp(header, REPLAY_MAGIC, 3) != 0 || header[3] != REPLAY_VERSION)
+        errx(EX_DATAERR, "not a replay file: %s", file);
+    return (uint32_t) header[4] | (uint32_t) header[5] << 8 |
+           (uint32_t) header[6] << 16 | (uint32_t) header[7] << 24;
+}
+
+static int read_varint(FILE *fh, uint64_t *value) {
+    int ch, shift = 0;
+    *value = 0;
+    do {
+        if ((ch = getc(fh)) == EOF || shift > 63) return 0;
+        *value |= (uint64_t) (ch & 0x7F) << shift;
+        shift += 7;
+    } while (ch & 0x80);
+    return 1;
+}
+
+void record_key(int ch) {
+    if (Record_Fh == NULL) return;
+    write_varint(Record_Fh, (uint64_t) (Game->turn - Record_Turn));
+    write_varint(Record_Fh, (uint64_t) ch);
+    Record_Turn = Game->turn;
+}
+
+void record_open(const char *file, uint32_t seed) {
+    if ((Record_Fh = fopen(file, "w")) == NULL) err(EX_CANTCREAT, "%s", file);
+    unsigned char header[8];
+    memcpy(header, REPLAY_MAGIC, 3);
+    header[3] = REPLAY_VERSION;
+    for (int i = 0; i < 4; i++)
+        header[4 + i] = seed >> (8 * i) & 0xFF;
+    fwrite(header, sizeof(header), 1, Record_Fh);
+}
+
+// prints how long the replay took and a hash of the ECS state then
+// exits; the hash should not change from one build to the next
+static void replay_exit(ClientData clientData) {
+    double secs        = (timing_now() - Replay_Start) / 1e9;
+    Tcl_Interp *interp = Game->interp;
+    if (Tcl_EvalEx(interp, "state_hash", -1, TCL_EVAL_GLOBAL) != TCL_OK)
+        errx(1, "state_hash failed: %s", Tcl_GetStringResult(interp));
+    printf("replay %ld keys %lld turns %.6f s %.1f keys/s state %s\n",
+           Replay_Keys, (long long) Game->turn, secs,
+           secs > 0 ? Replay_Keys / secs : 0.0, Tcl_GetStringResult(interp));
+    exit((int) (intptr_t) clientData);
+}
+
+int replaying(void) { return Replay_Fh != NULL; }
+
+// next recorded key or exits (via replay_exit) at the end of the file
+int replay_key(void) {
+    uint64_t delta, ch;
+    if (!read_varint(Replay_Fh, &delta) || !read_varint(Replay_Fh, &ch))
+        replay_exit((ClientData) 0);
+    Replay_Turn += delta;
+    if (Replay_Turn != Game->turn)
+        log_msg(LOG_WARN, "replay key %ld recorded on turn %lld now %lld",
+                Replay_Keys, (long long) Replay_Turn, (long long) Game->turn);
+    Replay_Keys++;
+    return (int) ch;
+}
+
+// returns the seed the game was recorded with
+uint32_t replay_open(const char *file) {
+    if ((Replay_Fh = fopen(file, "r")) == NULL) err(EX_NOINPUT, "%s", file);
+    return read_header(Replay_Fh, file);
+}
+
+// called once the game is set up, right before the first turn
+void replay_start(void) {
+    if (Replay_Fh == NULL) return;
+    // the game may quit on its own before the recording runs out
+    Tcl_SetExitProc(replay_exit);
+    Replay_Start = timing_now();
+}
+
+static void write_varint(FILE *fh, uint64_t value) {
+    do {
+        int byte = value & 0x7F;
+        value >>= 7;
+        putc(value ? byte | 0x80 : byte, fh);
+    } while (value);
+}
@@ -0,0 +1,78 @@
+/* snapshot-view - prints the level the player is on and the recent
+ * messages from the snapshot of a game run with -s, without getting in
+ * the way of the game
+ *
+ *   ./snapshot-view snapshot-file */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <err.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sysexits.h>
+#include <unistd.h>
+
+#include "snapshot.h"
+
+#define MAX_TRIES 1000
+
+int main(int argc, char *argv[]) {
+    int fd;
+    struct stat st;
+    if (argc != 2) {
+        fputs("Usage: ./snapshot-view snapshot-file\n", stderr);
+        exit(EX_USAGE);
+    }
+    if ((fd = open(argv[1], O_RDONLY)) == -1) err(EX_NOINPUT, "%s", argv[1]);
+    if (fstat(fd, &st) == -1) err(EX_IOERR, "fstat %s", argv[1]);
+    if ((size_t) st.st_size < sizeof(struct snapshot_header))
+        errx(EX_DATAERR, "not a snapshot: %s", argv[1]);
+    const struct snapshot_header *snap =
+        mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (snap == MAP_FAILED) err(EX_OSERR, "mmap %s", argv[1]);
+    close(fd);
+    if (memcmp(snap->magic, SNAPSHOT_MAGIC, 3) != 0 ||
+        snap->version != SNAPSHOT_VERSION || snap->size != st.st_size)
+        errx(EX_DATAERR, "not a snapshot: %s", argv[1]);
+
+    // the copy a seqlock reader makes: the header and the one level
+    size_t plane = (size_t) snap->size_x * snap->size_y;
+    struct snapshot_header head;
+    char *chars;
+    if ((chars = malloc(plane)) == NULL) err(EX_OSERR, "malloc");
+    int tries = 0;
+    while (1) {
+        if (++tries > MAX_TRIES) errx(EX_TEMPFAIL, "snapshot kept changing");
+        uint64_t seq = __atomic_load_n(&snap->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) continue;
+        memcpy(&head, snap, sizeof(head));
+        if (head.player_w >= 0 && head.player_w < head.size_w)
+            memcpy(chars,
+                   (const char *) snap + head.chars_offset +
+                       head.player_w * plane,
+                   plane);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&snap->seq, __ATOMIC_RELAXED) == seq) break;
+    }
+    if (head.seq == 0) errx(EX_TEMPFAIL, "nothing published yet");
+
+    printf("turn %lld level %d player %d,%d\n", (long long) head.turn,
+           head.player_w, head.player_x, head.player_y);
+    for (int y = 0; y < head.size_y; y++) {
+        for (int x = 0; x < head.size_x; x++)
+            putchar(x == head.player_x && y == head.player_y
+                        ? '@'
+                        : chars[x * head.size_y + y]);
+        putchar('\n');
+    }
+    for (int i = head.msg_count - 1; i >= 0; i--) {
+        const struct snapshot_message *msg = &head.messages[i];
+        printf("%6lld %s", (long long) msg->turn, msg->text);
+        if (msg->count > 1) printf(" (x%d)", msg->count);
+        putchar('\n');
+    }
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,88 @@
+/* world snapshot - the map layers, player position, and recent
+ * messages copied into a shared mmap'd file after each turn (see
+ * snapshot.h for the layout and how to read it) */
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <fcntl.h>
+
+#include "prentice.h"
+#include "snapshot.h"
+
+static const char *Snapshot_File;
+static struct snapshot_header *Snapshot;
+
+static void snapshot_map(void);
+
+// where to publish; the file is created once the map size is known
+void snapshot_open(const char *file) { Snapshot_File = file; }
+
+void snapshot_publish(int lvl, int x, int y) {
+    if (Snapshot_File == NULL) return;
+    if (Snapshot == NULL) snapshot_map();
+    struct snapshot_header *snap = Snapshot;
+    uint64_t seq                 = snap->seq;
+    __atomic_store_n(&snap->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    snap->turn     = Game->turn;
+    snap->player_w = lvl;
+    snap->player_x = x;
+    snap->player_y = y;
+    int count      = 0;
+    const char *text;
+    Tcl_WideInt turn;
+    int repeats;
+    while (count < SNAPSHOT_MESSAGES &&
+           message_nth(Game, count, &text, &turn, &repeats)) {
+        struct snapshot_message *msg = &snap->messages[count];
+        msg->turn                    = turn;
+        msg->count                   = repeats;
+        snprintf(msg->text, SNAPSHOT_MSG_LEN, "%s", text);
+        count++;
+    }
+    snap->msg_count = count;
+
+    size_t plane   = (size_t) Game->map_size_x * Game->map_size_y;
+    uint8_t *chars = (uint8_t *) snap + snap->chars_offset;
+    uint8_t *walls = (uint8_t *) snap + snap->walls_offset;
+    uint8_t *seen  = (uint8_t *) snap + snap->seen_offset;
+    for (int w = 0; w < Game->map_size_w; w++) {
+        // the layers are each one allocation per level (see map.c)
+        memcpy(chars + w * plane, Game->map_chars[w][0], plane);
+        for (size_t i = 0; i < plane; i++) {
+            walls[w * plane + i] = Game->map_walls[w][0][i] != 0;
+            seen[w * plane + i]  = Game->map_seen[w][0][i] != 0;
+        }
+    }
+
+    __atomic_store_n(&snap->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static void snapshot_map(void) {
+    assert(Game->map_chars != NULL);
+    size_t layer =
+        (size_t) Game->map_size_w * Game->map_size_x * Game->map_size_y;
+    size_t size  = sizeof(struct snapshot_header) + 3 * layer;
+    int fd;
+    // a new file each time so readers holding the old one open are not
+    // left looking at a truncated or resized mapping
+    unlink(Snapshot_File);
+    if ((fd = open(Snapshot_File, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1)
+        err(EX_CANTCREAT, "%s", Snapshot_File);
+    if (ftruncate(fd, (off_t) size) == -1)
+        err(EX_IOERR, "ftruncate %s", Snapshot_File);
+    Snapshot = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (Snapshot == MAP_FAILED) err(EX_OSERR, "mmap %s", Snapshot_File);
+    close(fd);
+    memcpy(Snapshot->magic, SNAPSHOT_MAGIC, 3);
+    Snapshot->version      = SNAPSHOT_VERSION;
+    Snapshot->size         = (uint32_t) size;
+    Snapshot->size_w       = Game->map_size_w;
+    Snapshot->size_x       = Game->map_size_x;
+    Snapshot->size_y       = Game->map_size_y;
+    Snapshot->chars_offset = sizeof(struct snapshot_header);
+    Snapshot->walls_offset = Snapshot->chars_offset + layer;
+    Snapshot->seen_offset  = Snapshot->walls_offset + layer;
+}
@@ -0,0 +1,43 @@
+#ifndef _H_SNAPSHOT_H_
+#define _H_SNAPSHOT_H_
+
+/* layout of the world snapshot the game publishes to a file (with -s)
+ * after each turn, for out-of-process observers to mmap read-only
+ *
+ * the header is followed by the message slots and then the chars,
+ * walls, and seen map layers, each size_w * size_x * size_y bytes and
+ * indexed as [w][x][y] at the offsets given in the header
+ *
+ * the seq field is a seqlock: it is odd while the game is writing. a
+ * reader loads seq (acquire), retries if odd, copies what it needs,
+ * then (after an acquire fence) loads seq again and retries if it
+ * changed. the game never waits on readers */
+
+#include <stdint.h>
+
+#define SNAPSHOT_MAGIC "PRS"
+#define SNAPSHOT_VERSION 1
+
+#define SNAPSHOT_MESSAGES 32
+#define SNAPSHOT_MSG_LEN 120
+
+struct snapshot_message {
+    int64_t turn;
+    int32_t count;
+    char text[SNAPSHOT_MSG_LEN]; // truncated, always NUL terminated
+};
+
+struct snapshot_header {
+    char magic[3];
+    uint8_t version;
+    uint32_t size; // of the whole file
+    uint64_t seq;
+    int64_t turn;
+    int32_t size_w, size_x, size_y;
+    int32_t player_w, player_x, player_y;
+    int32_t msg_count; // newest is messages[0]
+    uint32_t chars_offset, walls_offset, seen_offset;
+    struct snapshot_message messages[SNAPSHOT_MESSAGES];
+};
+
+#endif
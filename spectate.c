@@ -0,0 +1,175 @@
+/* spectators - with -S ncurses draws into a pipe instead of the
+ * terminal, and what comes out of it (the changes doupdate worked out)
+ * is copied to the player's terminal and to every client connected to
+ * a Unix domain socket. another viewer costs only the bytes sent to it
+ *
+ *   socat -,raw,echo=0 UNIX-CONNECT:socket-file */
+
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fcntl.h>
+#include <poll.h>
+
+#include "prentice.h"
+
+#define MAX_SPECTATORS 64
+
+static const char *Socket_Path;
+static int Listen_Fd = -1, Screen_Fd = -1, Tty_Fd = -1;
+static int Clients[MAX_SPECTATORS], Client_Count;
+static int Repaint; // a new client needs the whole screen
+static struct termios Tty_Saved;
+
+static void drain(void);
+static void set_nonblock(int fd);
+static void spectate_close(void);
+static void write_all(int fd, const char *buf, size_t len);
+
+static void drain(void) {
+    char buf[16384];
+    ssize_t len;
+    while ((len = read(Screen_Fd, buf, sizeof(buf))) > 0) {
+        if (Tty_Fd != -1) write_all(Tty_Fd, buf, len);
+        // clients that cannot keep up are dropped instead of being
+        // waited on
+        for (int i = 0; i < Client_Count; i++) {
+            if (write(Clients[i], buf, len) != len) {
+                close(Clients[i]);
+                Clients[i--] = Clients[--Client_Count];
+            }
+        }
+    }
+}
+
+static void set_nonblock(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+        err(EX_OSERR, "fcntl");
+}
+
+static void spectate_close(void) {
+    drain(); // whatever endwin had to say
+    if (Tty_Fd != -1) tcsetattr(STDIN_FILENO, TCSANOW, &Tty_Saved);
+    for (int i = 0; i < Client_Count; i++)
+        close(Clients[i]);
+    Client_Count = 0;
+    close(Listen_Fd);
+    unlink(Socket_Path);
+}
+
+// where to listen for spectators
+void spectate_open(const char *path) { Socket_Path = path; }
+
+// sends out what has been drawn and lets in new spectators; called
+// after each screen update
+void spectate_pump(void) {
+    int fd;
+    if (Screen_Fd == -1) return;
+    drain();
+    while ((fd = accept(Listen_Fd, NULL, NULL)) != -1) {
+        if (Client_Count == MAX_SPECTATORS) {
+            close(fd);
+            continue;
+        }
+        set_nonblock(fd);
+        Clients[Client_Count++] = fd;
+        Repaint                 = 1;
+    }
+    if (Repaint) {
+        Repaint = 0;
+        wrefresh(curscr);
+        drain();
+    }
+}
+
+// the output for newterm. tty is where the player's terminal is or -1
+// if there is no player
+FILE *spectate_screen(int tty) {
+    int fds[2];
+    struct sockaddr_un addr;
+    if (pipe(fds) == -1) err(EX_OSERR, "pipe");
+#ifdef F_SETPIPE_SZ
+    // room for many frames between drains
+    fcntl(fds[0], F_SETPIPE_SZ, 1 << 20);
+#endif
+    set_nonblock(fds[0]);
+    Screen_Fd = fds[0];
+    Tty_Fd    = tty;
+
+    if (strlen(Socket_Path) >= sizeof(addr.sun_path))
+        errx(EX_USAGE, "socket path too long: %s", Socket_Path);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, Socket_Path);
+    unlink(Socket_Path);
+    if ((Listen_Fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+        err(EX_OSERR, "socket");
+    if (bind(Listen_Fd, (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        err(EX_CANTCREAT, "bind %s", Socket_Path);
+    if (listen(Listen_Fd, 8) == -1) err(EX_OSERR, "listen");
+    set_nonblock(Listen_Fd);
+    signal(SIGPIPE, SIG_IGN);
+    atexit(spectate_close);
+
+    FILE *out;
+    if ((out = fdopen(fds[1], "w")) == NULL) err(EX_OSERR, "fdopen");
+    return out;
+}
+
+// ncurses sets the terminal modes on its output, which is now the
+// pipe, so the player's terminal gets cbreak, noecho, and nonl here
+void spectate_tty(void) {
+    struct termios raw;
+    struct winsize size;
+    if (Tty_Fd == -1) return;
+    if (tcgetattr(STDIN_FILENO, &Tty_Saved) == -1)
+        err(EX_OSERR, "tcgetattr");
+    raw = Tty_Saved;
+    raw.c_lflag &= ~(ICANON | ECHO);
+    raw.c_iflag &= ~ICRNL;
+    raw.c_cc[VMIN]  = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    if (ioctl(STDIN_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row &&
+        size.ws_col)
+        resizeterm(size.ws_row, size.ws_col);
+}
+
+// waits for a key from the player while serving spectators
+void spectate_wait(void) {
+    int ch = ERR;
+    if (Screen_Fd == -1) return;
+    if (Tty_Fd != -1) {
+        // ncurses may already have read the key (and getch refreshes
+        // stdscr, so this goes before the pump)
+        timeout(0);
+        if ((ch = getch()) != ERR) ungetch(ch);
+        timeout(-1);
+    }
+    spectate_pump();
+    if (Tty_Fd == -1 || ch != ERR) return;
+    struct pollfd fds[2] = {{STDIN_FILENO, POLLIN, 0},
+                            {Listen_Fd, POLLIN, 0}};
+    while (1) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            err(EX_OSERR, "poll");
+        }
+        if (fds[0].revents) return;
+        spectate_pump();
+    }
+}
+
+static void write_all(int fd, const char *buf, size_t len) {
+    while (len) {
+        ssize_t ret = write(fd, buf, len);
+        if (ret == -1) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        buf += ret;
+        len -= ret;
+    }
+}
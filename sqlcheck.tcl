@@ -0,0 +1,65 @@
+# sqlcheck.tcl - runs EXPLAIN QUERY PLAN on the SQL of every ecs eval,
+# onecolumn, and exists in init.tcl against the schema init.tcl made,
+# and fails if any query outside of the startup (and otherwise rarely
+# run) procs below scans a table instead of searching an index
+#
+#   ./prentice -n -b sqlcheck.tcl
+#
+# run from the directory init.tcl is in
+
+# may scan, as they run once at startup or on a rare key
+set cold_procs {cmd_commands init_map load_keys load_or_make_db make_db
+  set_boundaries state_hash}
+
+# the {...} SQL following each ecs method in the source, with the name
+# of the proc it is in
+proc sql_strings {source} {
+    set found {}
+    set proc {}
+    set len [string length $source]
+    set re {ecs (?:eval|onecolumn|exists) \{}
+    set at 0
+    while {[regexp -indices -start $at $re $source match]} {
+        set open [lindex $match 1]
+        set before [string range $source 0 $open]
+        if {[regexp {.*\nproc (\S+)} $before -> name]} {set proc $name}
+        set depth 1
+        for {set i [+ $open 1]} {$i < $len && $depth} {incr i} {
+            switch -- [string index $source $i] {
+                \{ {incr depth}
+                \} {incr depth -1}
+            }
+        }
+        lappend found $proc [string range $source [+ $open 1] [- $i 2]]
+        set at $i
+    }
+    return $found
+}
+
+set fh [open init.tcl]
+set source [read $fh]
+close $fh
+
+set checked 0
+set failed 0
+foreach {proc sql} [sql_strings $source] {
+    # schema and other multiple statement evals
+    if {[regexp -nocase {\m(CREATE|PRAGMA)\M} $sql]} {continue}
+    incr checked
+    set sql [string trim $sql]
+    set scans {}
+    # unset variables bind as NULL, which is fine for a plan
+    ecs eval "EXPLAIN QUERY PLAN $sql" row {
+        if {[regexp {^SCAN (\S+)} $row(detail) -> what] &&
+            $what ne "CONSTANT"} {
+            lappend scans $row(detail)
+        }
+    }
+    if {![llength $scans]} {continue}
+    set cold [expr {$proc in $cold_procs}]
+    if {!$cold} {incr failed}
+    puts "[expr {$cold ? {cold} : {FAIL}}] $proc: [join $scans {; }]"
+    puts "  [regsub -all {\s+} $sql { }]"
+}
+puts "$checked queries checked, $failed hot queries scan"
+if {$failed} {exit 1}
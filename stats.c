@@ -0,0 +1,321 @@
+/* stats - hit points, attack, and defense of whatever can fight, kept
+ * in C as columns (a struct of arrays) so that a blow, or an area
+ * effect on hundreds of entities, is a pass over the columns instead of
+ * a query or several per entity. a sparse set maps entid to the dense
+ * index. the stats table in SQL is only brought up to date at save
+ * points (see stat_sync in init.tcl) */
+
+#include <limits.h>
+
+#include "prentice.h"
+
+// entids are INTEGER PRIMARY KEY rowids handed out from 1, so the
+// sparse array is about as long as there have been entities
+#define MAX_STAT_ENTID (INT_MAX - 1)
+
+struct stats {
+    // the columns, count long
+    Tcl_WideInt *entid;
+    int *hp, *attack, *defense;
+    unsigned char *dirty; // changed since the last statsync
+    int count, size;
+    // entid to dense index + 1, or 0 if the entity has no stats
+    int *sparse;
+    Tcl_WideInt sparse_size;
+    // removed since the last statsync
+    Tcl_WideInt *gone;
+    int gone_count, gone_size;
+};
+
+static int get_entid(Tcl_Interp *interp, Tcl_Obj *obj, Tcl_WideInt *entid);
+static int pr_resolve_attacks(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]);
+static int pr_statdel(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_statdump(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_statget(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_statload(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static int pr_statset(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]);
+static int pr_statsync(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]);
+static void stat_clear(struct stats *stats);
+static void stat_del(struct stats *stats, Tcl_WideInt entid);
+static int stat_index(struct stats *stats, Tcl_WideInt entid);
+static int stat_put(struct stats *stats, Tcl_WideInt entid);
+
+static int get_entid(Tcl_Interp *interp, Tcl_Obj *obj, Tcl_WideInt *entid) {
+    if (Tcl_GetWideIntFromObj(interp, obj, entid) != TCL_OK)
+        return TCL_ERROR;
+    if (*entid < 0 || *entid > MAX_STAT_ENTID) {
+        Tcl_SetObjResult(interp, Tcl_ObjPrintf("entid %lld out of range",
+                                               (long long) *entid));
+        return TCL_ERROR;
+    }
+    return TCL_OK;
+}
+
+// {attacker target ...} - each attacker strikes the target in turn, for
+// their attack less the target's defense but always at least 1. the
+// dead (at 0 hp or less) neither strike nor are struck, nor does
+// anything without stats. returns {target damage hp ...} for the blows
+// that landed
+static int pr_resolve_attacks(ClientData clientData, Tcl_Interp *interp,
+                              int objc, Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    int count;
+    Tcl_Obj **list;
+    assert(objc == 2);
+    if (Tcl_ListObjGetElements(interp, objv[1], &count, &list) != TCL_OK)
+        return TCL_ERROR;
+    assert((count & 1) == 0);
+
+    Tcl_Obj *hits = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(hits);
+    for (int i = 0; i < count; i += 2) {
+        Tcl_WideInt attacker, target;
+        if (Tcl_GetWideIntFromObj(interp, list[i], &attacker) != TCL_OK ||
+            Tcl_GetWideIntFromObj(interp, list[i + 1], &target) != TCL_OK) {
+            Tcl_DecrRefCount(hits);
+            return TCL_ERROR;
+        }
+        int a = stat_index(stats, attacker), t = stat_index(stats, target);
+        if (a == -1 || t == -1 || stats->hp[a] <= 0 || stats->hp[t] <= 0)
+            continue;
+        int damage = stats->attack[a] - stats->defense[t];
+        if (damage < 1) damage = 1;
+        stats->hp[t] -= damage;
+        stats->dirty[t] = 1;
+        Tcl_ListObjAppendElement(interp, hits, list[i + 1]);
+        Tcl_ListObjAppendElement(interp, hits, Tcl_NewIntObj(damage));
+        Tcl_ListObjAppendElement(interp, hits, Tcl_NewIntObj(stats->hp[t]));
+    }
+    Tcl_SetObjResult(interp, hits);
+    Tcl_DecrRefCount(hits);
+    return TCL_OK;
+}
+
+// entid - the entity no longer has stats
+static int pr_statdel(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game = clientData;
+    Tcl_WideInt entid;
+    assert(objc == 2);
+    if (get_entid(interp, objv[1], &entid) != TCL_OK) return TCL_ERROR;
+    stat_del(game->stats, entid);
+    return TCL_OK;
+}
+
+// {entid hp attack defense ...} of every entity with stats, by entid
+static int pr_statdump(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    Tcl_Obj *rows       = Tcl_NewListObj(0, NULL);
+    for (Tcl_WideInt entid = 0; entid < stats->sparse_size; entid++) {
+        int i = stats->sparse[entid] - 1;
+        if (i == -1) continue;
+        Tcl_Obj *row[4] = {
+            Tcl_NewWideIntObj(entid), Tcl_NewIntObj(stats->hp[i]),
+            Tcl_NewIntObj(stats->attack[i]), Tcl_NewIntObj(stats->defense[i])};
+        for (int j = 0; j < 4; j++)
+            Tcl_ListObjAppendElement(interp, rows, row[j]);
+    }
+    Tcl_SetObjResult(interp, rows);
+    return TCL_OK;
+}
+
+// entid - hp attack defense, or an empty list if it has no stats
+static int pr_statget(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    Tcl_WideInt entid;
+    assert(objc == 2);
+    if (get_entid(interp, objv[1], &entid) != TCL_OK) return TCL_ERROR;
+    int i = stat_index(stats, entid);
+    if (i == -1) return TCL_OK;
+    Tcl_Obj *row[3] = {Tcl_NewIntObj(stats->hp[i]),
+                       Tcl_NewIntObj(stats->attack[i]),
+                       Tcl_NewIntObj(stats->defense[i])};
+    Tcl_SetObjResult(interp, Tcl_NewListObj(3, row));
+    return TCL_OK;
+}
+
+// {entid hp attack defense ...} - as read from the stats table of a
+// saved game; replaces whatever was there, with nothing left to sync
+static int pr_statload(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    int count;
+    Tcl_Obj **list;
+    assert(objc == 2);
+    if (Tcl_ListObjGetElements(interp, objv[1], &count, &list) != TCL_OK)
+        return TCL_ERROR;
+    assert(count % 4 == 0);
+    stat_clear(stats);
+    for (int i = 0; i < count; i += 4) {
+        Tcl_WideInt entid;
+        int hp, attack, defense;
+        if (get_entid(interp, list[i], &entid) != TCL_OK ||
+            Tcl_GetIntFromObj(interp, list[i + 1], &hp) != TCL_OK ||
+            Tcl_GetIntFromObj(interp, list[i + 2], &attack) != TCL_OK ||
+            Tcl_GetIntFromObj(interp, list[i + 3], &defense) != TCL_OK)
+            return TCL_ERROR;
+        int j             = stat_put(stats, entid);
+        stats->hp[j]      = hp;
+        stats->attack[j]  = attack;
+        stats->defense[j] = defense;
+        stats->dirty[j]   = 0;
+    }
+    return TCL_OK;
+}
+
+// entid hp attack defense
+static int pr_statset(ClientData clientData, Tcl_Interp *interp, int objc,
+                      Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    Tcl_WideInt entid;
+    int hp, attack, defense;
+    assert(objc == 5);
+    if (get_entid(interp, objv[1], &entid) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[2], &hp) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[3], &attack) != TCL_OK ||
+        Tcl_GetIntFromObj(interp, objv[4], &defense) != TCL_OK)
+        return TCL_ERROR;
+    int i               = stat_put(stats, entid);
+    stats->hp[i]        = hp;
+    stats->attack[i]    = attack;
+    stats->defense[i]   = defense;
+    stats->dirty[i]     = 1;
+    return TCL_OK;
+}
+
+// {entid hp attack defense ...} changed and {entid ...} removed since
+// the last call, for stat_sync to write to the stats table
+static int pr_statsync(ClientData clientData, Tcl_Interp *interp, int objc,
+                       Tcl_Obj *CONST objv[]) {
+    struct game *game   = clientData;
+    struct stats *stats = game->stats;
+    Tcl_Obj *changed = Tcl_NewListObj(0, NULL), *gone = Tcl_NewListObj(0, NULL);
+    for (int i = 0; i < stats->count; i++) {
+        if (!stats->dirty[i]) continue;
+        Tcl_Obj *row[4] = {
+            Tcl_NewWideIntObj(stats->entid[i]), Tcl_NewIntObj(stats->hp[i]),
+            Tcl_NewIntObj(stats->attack[i]), Tcl_NewIntObj(stats->defense[i])};
+        for (int j = 0; j < 4; j++)
+            Tcl_ListObjAppendElement(interp, changed, row[j]);
+        stats->dirty[i] = 0;
+    }
+    for (int i = 0; i < stats->gone_count; i++)
+        Tcl_ListObjAppendElement(interp, gone,
+                                 Tcl_NewWideIntObj(stats->gone[i]));
+    stats->gone_count = 0;
+    Tcl_Obj *result[2] = {changed, gone};
+    Tcl_SetObjResult(interp, Tcl_NewListObj(2, result));
+    return TCL_OK;
+}
+
+static void stat_clear(struct stats *stats) {
+    for (int i = 0; i < stats->count; i++)
+        stats->sparse[stats->entid[i]] = 0;
+    stats->count      = 0;
+    stats->gone_count = 0;
+}
+
+// the last row is moved into the hole
+static void stat_del(struct stats *stats, Tcl_WideInt entid) {
+    int i = stat_index(stats, entid);
+    if (i == -1) return;
+    int last = --stats->count;
+    if (i != last) {
+        stats->entid[i]                 = stats->entid[last];
+        stats->hp[i]                    = stats->hp[last];
+        stats->attack[i]                = stats->attack[last];
+        stats->defense[i]               = stats->defense[last];
+        stats->dirty[i]                 = stats->dirty[last];
+        stats->sparse[stats->entid[i]] = i + 1;
+    }
+    stats->sparse[entid] = 0;
+    if (stats->gone_count == stats->gone_size) {
+        stats->gone_size = stats->gone_size ? stats->gone_size * 2 : 16;
+        if ((stats->gone = realloc(stats->gone, sizeof(Tcl_WideInt) *
+                                                    stats->gone_size)) ==
+            NULL)
+            oom();
+    }
+    stats->gone[stats->gone_count++] = entid;
+}
+
+inline static int stat_index(struct stats *stats, Tcl_WideInt entid) {
+    if (entid < 0 || entid >= stats->sparse_size) return -1;
+    return stats->sparse[entid] - 1;
+}
+
+// the row for the entity, added (and zeroed) if need be
+static int stat_put(struct stats *stats, Tcl_WideInt entid) {
+    assert(entid >= 0 && entid <= MAX_STAT_ENTID);
+    int i = stat_index(stats, entid);
+    if (i != -1) return i;
+    if (entid >= stats->sparse_size) {
+        Tcl_WideInt size = stats->sparse_size ? stats->sparse_size : 64;
+        while (size <= entid)
+            size *= 2;
+        if ((stats->sparse = realloc(stats->sparse, sizeof(int) * size)) ==
+            NULL)
+            oom();
+        memset(stats->sparse + stats->sparse_size, 0,
+               sizeof(int) * (size - stats->sparse_size));
+        stats->sparse_size = size;
+    }
+    if (stats->count == stats->size) {
+        stats->size = stats->size ? stats->size * 2 : 64;
+#define GROW(col)                                                              \
+    if ((stats->col = realloc(stats->col, sizeof(*stats->col) *                \
+                                              stats->size)) == NULL)           \
+    oom()
+        GROW(entid);
+        GROW(hp);
+        GROW(attack);
+        GROW(defense);
+        GROW(dirty);
+#undef GROW
+    }
+    i                    = stats->count++;
+    stats->entid[i]      = entid;
+    stats->hp[i]         = 0;
+    stats->attack[i]     = 0;
+    stats->defense[i]    = 0;
+    stats->dirty[i]      = 1;
+    stats->sparse[entid] = i + 1;
+    return i;
+}
+
+void stats_commands(struct game *game) {
+    if ((game->stats = calloc(1, sizeof(struct stats))) == NULL) oom();
+    LINK_COMMAND(game, "resolve_attacks", pr_resolve_attacks);
+    LINK_COMMAND(game, "statdel", pr_statdel);
+    LINK_COMMAND(game, "statdump", pr_statdump);
+    LINK_COMMAND(game, "statget", pr_statget);
+    LINK_COMMAND(game, "statload", pr_statload);
+    LINK_COMMAND(game, "statset", pr_statset);
+    LINK_COMMAND(game, "statsync", pr_statsync);
+}
+
+void stats_free(struct game *game) {
+    struct stats *stats = game->stats;
+    free(stats->entid);
+    free(stats->hp);
+    free(stats->attack);
+    free(stats->defense);
+    free(stats->dirty);
+    free(stats->sparse);
+    free(stats->gone);
+    free(stats);
+}
@@ -0,0 +1,14 @@
+# tclsqlite-flag.tcl - prints the -DTCLSQLITE_LIB cc flag for where the
+# sqlite3 extension is, so the game can load it directly instead of
+# searching for it by way of Tcl_Init; the Makefile runs this
+#
+#   tclsh8.6 tclsqlite-flag.tcl
+
+package require sqlite3
+foreach lib [info loaded] {
+    lassign $lib file name
+    if {$name eq "Sqlite3" && $file ne ""} {
+        puts "-DTCLSQLITE_LIB='\"$file\"'"
+        break
+    }
+}
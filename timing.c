@@ -0,0 +1,342 @@
+/* timing histograms - monotonic clock timers recorded into log-linear
+ * (HDR-style) histograms, dumped as JSON on a key or SIGUSR1 */
+
+#include "prentice.h"
+
+// each power of two is split into this many linear buckets, so any
+// recorded value is off by at most 1/16th (~6%)
+#define HIST_SUB_BITS 4
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+    uint64_t count, sum, min, max;
+    uint32_t buckets[HIST_BUCKETS];
+};
+
+// only the game on the screen records (hosted games get the no-op
+// commands below) and the signal handler only sets a flag, so the
+// counters need no locks. the histograms are by name id, NULL for
+// names that are not timed
+static struct hist **Hists;
+static int Hist_Size;
+static volatile sig_atomic_t Dump_Wanted;
+
+// names of the timers, procs, and SQL, shared with the profiler
+static Tcl_HashTable Name_Ids;
+static char **Names;
+static int Name_Count, Name_Size;
+
+static int bucket_index(uint64_t value);
+static uint64_t bucket_value(int index);
+static void dump_hist(FILE *fh, const char *name, struct hist *h);
+static void handle_usr1(int sig);
+static uint64_t percentile(struct hist *h, double pct);
+static int pr_timing_nop(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]);
+
+inline static int bucket_index(uint64_t value) {
+    if (value < HIST_SUB) return (int) value;
+    int shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int) ((value >> shift) & (HIST_SUB - 1));
+}
+
+// lowest value that lands in the given bucket
+inline static uint64_t bucket_value(int index) {
+    if (index < HIST_SUB) return (uint64_t) index;
+    int shift = index / HIST_SUB - 1;
+    return ((uint64_t) HIST_SUB + index % HIST_SUB) << shift;
+}
+
+static void dump_hist(FILE *fh, const char *name, struct hist *h) {
+    fputs("{\"name\":\"", fh);
+    json_fputs(name, fh);
+    fprintf(fh,
+            "\",\"count\":%llu,\"min\":%llu,\"max\":%llu,\"mean\":%llu,"
+            "\"p50\":%llu,\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,"
+            "\"buckets\":[",
+            (unsigned long long) h->count, (unsigned long long) h->min,
+            (unsigned long long) h->max,
+            (unsigned long long) (h->count ? h->sum / h->count : 0),
+            (unsigned long long) percentile(h, 50.0),
+            (unsigned long long) percentile(h, 90.0),
+            (unsigned long long) percentile(h, 99.0),
+            (unsigned long long) percentile(h, 99.9));
+    int first = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        if (!h->buckets[i]) continue;
+        fprintf(fh, "%s[%llu,%lu]", first ? "" : ",",
+                (unsigned long long) bucket_value(i),
+                (unsigned long) h->buckets[i]);
+        first = 0;
+    }
+    fputs("]}", fh);
+}
+
+static void handle_usr1(int sig) { Dump_Wanted = 1; }
+
+// the id of the name, the same for any name that differs only in
+// whitespace: SQL is used as a name, so runs of whitespace are squashed
+// for the output
+int name_intern(const char *name) {
+    int isnew;
+    Tcl_HashEntry *entry = Tcl_CreateHashEntry(&Name_Ids, name, &isnew);
+    if (!isnew) return (int) (intptr_t) Tcl_GetHashValue(entry);
+    char *text;
+    if ((text = malloc(strlen(name) + 1)) == NULL) oom();
+    char *d = text;
+    for (const char *s = name; *s; s++) {
+        if (isspace((unsigned char) *s)) {
+            if (d == text || d[-1] == ' ') continue;
+            *d++ = ' ';
+        } else
+            *d++ = *s;
+    }
+    if (d > text && d[-1] == ' ') d--;
+    *d = '\0';
+    // the squashed name may be known by itself or by another spelling
+    int id, squashed    = 1;
+    Tcl_HashEntry *same = entry;
+    if (strcmp(text, name) != 0)
+        same = Tcl_CreateHashEntry(&Name_Ids, text, &squashed);
+    if (!squashed) {
+        id = (int) (intptr_t) Tcl_GetHashValue(same);
+        free(text);
+    } else {
+        if (Name_Count == Name_Size) {
+            Name_Size = Name_Size ? Name_Size * 2 : 256;
+            if ((Names = realloc(Names, sizeof(char *) * Name_Size)) == NULL)
+                oom();
+        }
+        id        = Name_Count++;
+        Names[id] = text;
+        Tcl_SetHashValue(same, (ClientData) (intptr_t) id);
+    }
+    Tcl_SetHashValue(entry, (ClientData) (intptr_t) id);
+    return id;
+}
+
+const char *name_text(int id) {
+    assert(id >= 0 && id < Name_Count);
+    return Names[id];
+}
+
+static uint64_t percentile(struct hist *h, double pct) {
+    if (!h->count) return 0;
+    uint64_t want = (uint64_t) (h->count * pct / 100.0 + 0.5), seen = 0;
+    if (want < 1) want = 1;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= want) {
+            uint64_t value = bucket_value(i);
+            return value < h->min ? h->min : value > h->max ? h->max : value;
+        }
+    }
+    return h->max;
+}
+
+static int pr_timing_add(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]) {
+    Tcl_WideInt start;
+    assert(objc == 3);
+    Tcl_GetWideIntFromObj(interp, objv[2], &start);
+    timing_add(timing_id(Tcl_GetString(objv[1])), (uint64_t) start);
+    return TCL_OK;
+}
+
+static int pr_timing_dump(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 1 || objc == 2);
+    timing_dump(objc == 2 ? Tcl_GetString(objv[1]) : TIMING_FILE);
+    return TCL_OK;
+}
+
+static int pr_timing_now(ClientData clientData, Tcl_Interp *interp,
+                         int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_SetObjResult(interp, Tcl_NewWideIntObj((Tcl_WideInt) timing_now()));
+    return TCL_OK;
+}
+
+// for hosted games, whose timings would be mixed in with the others
+static int pr_timing_nop(ClientData clientData, Tcl_Interp *interp, int objc,
+                         Tcl_Obj *CONST objv[]) {
+    return TCL_OK;
+}
+
+// name and duration in nanoseconds
+static int pr_timing_record(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_WideInt nsec;
+    assert(objc == 3);
+    Tcl_GetWideIntFromObj(interp, objv[2], &nsec);
+    timing_record(timing_id(Tcl_GetString(objv[1])), (uint64_t) nsec);
+    return TCL_OK;
+}
+
+// count, min, max, mean, and percentiles of the named histogram as a
+// dict, or an empty dict if nothing has been recorded under that name
+static int pr_timing_stats(ClientData clientData, Tcl_Interp *interp,
+                           int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 2);
+    Tcl_Obj *dict = Tcl_NewDictObj();
+    int id = name_intern(Tcl_GetString(objv[1]));
+    if (id < Hist_Size && Hists[id] != NULL) {
+        struct hist *h = Hists[id];
+        const char *keys[] = {"count", "min", "max", "mean",
+                              "p50",   "p90", "p99", "p999"};
+        uint64_t values[]  = {h->count,
+                             h->min,
+                             h->max,
+                             h->count ? h->sum / h->count : 0,
+                             percentile(h, 50.0),
+                             percentile(h, 90.0),
+                             percentile(h, 99.0),
+                             percentile(h, 99.9)};
+        for (int i = 0; i < 8; i++)
+            Tcl_DictObjPut(NULL, dict, Tcl_NewStringObj(keys[i], -1),
+                           Tcl_NewWideIntObj((Tcl_WideInt) values[i]));
+    }
+    Tcl_SetObjResult(interp, dict);
+    return TCL_OK;
+}
+
+// stands in for a sqlite database command and times the eval, exists,
+// and onecolumn calls made through it by the SQL given
+static int pr_timing_sqlite(ClientData clientData, Tcl_Interp *interp,
+                            int objc, Tcl_Obj *CONST objv[]) {
+    Tcl_Obj *stackv[8], **argv = stackv;
+    if (objc > 8) argv = (Tcl_Obj **) ckalloc(sizeof(Tcl_Obj *) * objc);
+    argv[0] = (Tcl_Obj *) clientData;
+    for (int i = 1; i < objc; i++)
+        argv[i] = objv[i];
+    int id = -1;
+    if (objc > 2) {
+        const char *sub = Tcl_GetString(objv[1]);
+        if (strcmp(sub, "eval") == 0 || strcmp(sub, "exists") == 0 ||
+            strcmp(sub, "onecolumn") == 0)
+            id = timing_id(Tcl_GetString(objv[2]));
+    }
+    uint64_t start = timing_now();
+    int ret        = Tcl_EvalObjv(interp, objc, argv, 0);
+    if (id != -1) timing_add(id, start);
+    if (argv != stackv) ckfree((char *) argv);
+    return ret;
+}
+
+// renames the given (sqlite database) command to name-untimed and puts
+// a timing wrapper in its place
+static int pr_timing_wrap(ClientData clientData, Tcl_Interp *interp,
+                          int objc, Tcl_Obj *CONST objv[]) {
+    assert(objc == 2);
+    const char *name = Tcl_GetString(objv[1]);
+    Tcl_Obj *real    = Tcl_ObjPrintf("%s-untimed", name);
+    Tcl_Obj *rename  = Tcl_NewListObj(0, NULL);
+    Tcl_IncrRefCount(real);
+    Tcl_IncrRefCount(rename);
+    Tcl_ListObjAppendElement(NULL, rename, Tcl_NewStringObj("rename", -1));
+    Tcl_ListObjAppendElement(NULL, rename, objv[1]);
+    Tcl_ListObjAppendElement(NULL, rename, real);
+    int ret = Tcl_EvalObjEx(interp, rename, 0);
+    Tcl_DecrRefCount(rename);
+    if (ret != TCL_OK) {
+        Tcl_DecrRefCount(real);
+        return ret;
+    }
+    if (Tcl_CreateObjCommand(interp, name, pr_timing_sqlite, real,
+                             (Tcl_CmdDeleteProc *) NULL) == NULL)
+        errx(1, "Tcl_CreateObjCommand failed");
+    return TCL_OK;
+}
+
+void setup_timing(void) {
+    Tcl_InitHashTable(&Name_Ids, TCL_STRING_KEYS);
+    // fixed slots for the C side timers, the first names there are
+    timing_id("digital_fov");
+    timing_id("drawmap");
+    timing_id("doupdate");
+    timing_id("getch");
+    timing_id("light");
+    assert(Name_Count == TIME_LIGHT + 1);
+    signal(SIGUSR1, handle_usr1);
+}
+
+void timing_commands(struct game *game) {
+    LINK_COMMAND(game, "timing_now", pr_timing_now);
+    if (game->hosted) {
+        LINK_COMMAND(game, "timing_add", pr_timing_nop);
+        LINK_COMMAND(game, "timing_dump", pr_timing_nop);
+        LINK_COMMAND(game, "timing_record", pr_timing_nop);
+        LINK_COMMAND(game, "timing_stats", pr_timing_nop);
+        LINK_COMMAND(game, "timing_wrap", pr_timing_nop);
+        return;
+    }
+    LINK_COMMAND(game, "timing_add", pr_timing_add);
+    LINK_COMMAND(game, "timing_dump", pr_timing_dump);
+    LINK_COMMAND(game, "timing_record", pr_timing_record);
+    LINK_COMMAND(game, "timing_stats", pr_timing_stats);
+    LINK_COMMAND(game, "timing_wrap", pr_timing_wrap);
+}
+
+void timing_add(int id, uint64_t start) {
+    timing_record(id, timing_now() - start);
+}
+
+void timing_dump(const char *file) {
+    FILE *fh;
+    Dump_Wanted = 0;
+    if ((fh = fopen(file, "w")) == NULL) {
+        log_msg(LOG_WARN, "could not write %s: %s", file, strerror(errno));
+        return;
+    }
+    fputs("{\"unit\":\"ns\",\"histograms\":[", fh);
+    int first = 1;
+    for (int i = 0; i < Hist_Size; i++) {
+        if (Hists[i] == NULL) continue;
+        if (!first) fputc(',', fh);
+        dump_hist(fh, Names[i], Hists[i]);
+        first = 0;
+    }
+    fputs("]}\n", fh);
+    fclose(fh);
+}
+
+// the histogram for the given name, created if need be
+int timing_id(const char *name) {
+    int id = name_intern(name);
+    if (id >= Hist_Size) {
+        int size = Hist_Size ? Hist_Size : 64;
+        while (size <= id)
+            size *= 2;
+        if ((Hists = realloc(Hists, sizeof(struct hist *) * size)) == NULL)
+            oom();
+        memset(Hists + Hist_Size, 0,
+               sizeof(struct hist *) * (size - Hist_Size));
+        Hist_Size = size;
+    }
+    if (Hists[id] == NULL) {
+        if ((Hists[id] = calloc(1, sizeof(struct hist))) == NULL) oom();
+        Hists[id]->min = UINT64_MAX;
+    }
+    return id;
+}
+
+uint64_t timing_now(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+}
+
+// dump if SIGUSR1 came in; called from the input loop
+void timing_poll(void) {
+    if (Dump_Wanted) timing_dump(TIMING_FILE);
+}
+
+void timing_record(int id, uint64_t nsec) {
+    assert(id >= 0 && id < Hist_Size && Hists[id] != NULL);
+    struct hist *h = Hists[id];
+    h->count++;
+    h->sum += nsec;
+    if (nsec < h->min) h->min = nsec;
+    if (nsec > h->max) h->max = nsec;
+    h->buckets[bucket_index(nsec)]++;
+}